@@ -0,0 +1,146 @@
+/**
+ * \file
+ * \brief     Benchmark of the FileHasher read engine against chksumLocFile
+ * \copyright Copyright (c) 2026, Utrecht University
+ *
+ * This file is part of irods-uu-microservices.
+ *
+ * irods-uu-microservices is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * irods-uu-microservices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with irods-uu-microservices.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Usage: file_hasher_benchmark [-w] [-n runs] file...
+ *
+ * Every file is hashed with SHA256 by chksumLocFile, by FileHasher through the page cache and by FileHasher with
+ * direct I/O. Before every run the file is dropped from the page cache, unless -w (warm) is given. The best
+ * throughput of the runs is reported, and the checksums are compared.
+ */
+#include "irods/checksum.h"
+#include "irods/rodsDef.h"
+#include "Digest.hh"
+#include "FileHasher.hh"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+
+/** Drop a file from the page cache, as far as it is not in use.
+ */
+static void evict(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/** Hash a file with chksumLocFile, return 0 or an iRODS error.
+ */
+static int hash_irods(const char* path, std::string& checksum)
+{
+    char str[NAME_LEN];
+
+    int status = chksumLocFile(path, str, "sha256");
+    checksum = (status < 0) ? "" : str;
+    return status;
+}
+
+/** Hash a file with FileHasher, return 0 or a negative errno.
+ */
+static int hash_engine(const char* path, bool direct, std::string& checksum)
+{
+    FileHasher hasher;
+    Digest digest("sha256");
+
+    int status = hasher.open(path, direct);
+    if (status == 0) {
+        status = hasher.read([&digest](const char* buf, size_t len) { digest.update(buf, len); });
+    }
+    checksum = (status < 0) ? "" : digest.checksum();
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    static const char* names[] = {"chksumLocFile", "FileHasher", "FileHasher direct"};
+    bool warm = false;
+    int runs = 3;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "wn:")) != -1) {
+        if (opt == 'w') {
+            warm = true;
+        }
+        else if (opt == 'n') {
+            runs = atoi(optarg);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-w] [-n runs] file...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind == argc || runs < 1) {
+        fprintf(stderr, "usage: %s [-w] [-n runs] file...\n", argv[0]);
+        return 2;
+    }
+
+    int result = 0;
+    for (int i = optind; i < argc; i++) {
+        const char* path = argv[i];
+        std::string checksums[3];
+        double best[3] = {0, 0, 0};
+        struct stat st;
+
+        if (stat(path, &st) < 0) {
+            perror(path);
+            result = 1;
+            continue;
+        }
+        for (int run = 0; run < runs; run++) {
+            for (int method = 0; method < 3; method++) {
+                if (!warm) {
+                    evict(path);
+                }
+                auto start = std::chrono::steady_clock::now();
+                int status = (method == 0) ? hash_irods(path, checksums[method])
+                                           : hash_engine(path, method == 2, checksums[method]);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                if (status < 0) {
+                    fprintf(stderr, "%s: %s failed (%d)\n", path, names[method], status);
+                    result = 1;
+                }
+                else if (elapsed.count() > 0) {
+                    double rate = (double) st.st_size / elapsed.count() / (1024 * 1024);
+                    best[method] = (rate > best[method]) ? rate : best[method];
+                }
+            }
+        }
+
+        printf("%s (%lld bytes, %s)\n", path, (long long) st.st_size, warm ? "warm" : "cold");
+        for (int method = 0; method < 3; method++) {
+            printf("  %-18s %10.1f MiB/s  %s\n", names[method], best[method], checksums[method].c_str());
+        }
+        if (checksums[1] != checksums[0] || checksums[2] != checksums[0]) {
+            fprintf(stderr, "%s: checksums differ\n", path);
+            result = 1;
+        }
+    }
+
+    return result;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <archive.h>
 #include <archive_entry.h>
 #include <jansson.h>
@@ -7,16 +9,39 @@
 #include "rsDataObjRead.hpp"
 #include "rsDataObjWrite.hpp"
 #include "rsDataObjClose.hpp"
+#include "rsDataObjLseek.hpp"
 #include "rsCollCreate.hpp"
+#include "rsObjStat.hpp"
+#include "rsGenQuery.hpp"
 #include "rcMisc.h"
+#include "Cbor.hh"
+#include "IndexCache.hh"
+#include "ItemTable.hh"
+#include "ZipWriter.hh"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <math.h>
 #include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
-#define A_BUFSIZE   (1024 * 1024)
-#define A_BLOCKSIZE ((size_t) 8192)
+#define A_BUFSIZE    (1024 * 1024)
+#define A_BLOCKSIZE  ((size_t) 8192)
+#define A_SIDECAR    ".index.json"
+#define A_JOBSUFFIX  ".job.json"
+#define A_TARBLOCK   512
+#define A_VERSION    2
+#define A_INDEX      "INDEX.json"
+#define A_INDEXCBOR  "INDEX.cbor"
+#define A_ZIPTHREADS 4
 
 /*
  * libarchive for iRODS
@@ -66,9 +91,31 @@ class Archive
     {
         data->resource = resc;
         index = 0;
+        base = 0;
+        version = A_VERSION;
+        cbor = false;
+        order = ItemTable::ORDER_CATALOG;
+        compression = COMPRESS_AUTO;
+        threads = A_ZIPTHREADS;
+        zip = NULL;
+        attributeSets = NULL;
+        aclSets = NULL;
+        origins = NULL;
+        reserve = 0;
+        indexOffset = -1;
     }
 
   public:
+    /*
+     * compression of DataObjs in zip archives
+     */
+    enum
+    {
+        COMPRESS_AUTO, /* deflate, except for DataObjs that are already compressed */
+        COMPRESS_DEFLATE, /* always deflate */
+        COMPRESS_STORE /* never compress */
+    };
+
     /*
      * create archive
      */
@@ -77,22 +124,31 @@ class Archive
         struct archive* a;
         Data* data;
 
+        data = new Data(rsComm, path.c_str());
+        data->resource = resc;
+        if (isZip(path)) {
+            /*
+             * zip archives are written by ZipWriter, which compresses in
+             * parallel
+             */
+            data->index = _creat(data, data->name);
+            if (data->index < 0) {
+                delete data;
+                return NULL;
+            }
+            return new Archive(NULL, data, true, json_array(), 0, path, collection, resc, "");
+        }
+
         /*
          * Create archive, determine format and compression mode based on
-         * the name: archive.tar, archive.zip, archive.tar.gz
+         * the name: archive.tar, archive.tar.gz
          */
         a = archive_write_new();
         if (a == NULL) {
+            delete data;
             return NULL;
         }
-        if (path.length() >= 4 && !path.compare(path.length() - 4, 4, ".zip")) {
-            archive_write_set_format_zip(a);
-        }
-        else {
-            archive_write_set_format_pax(a);
-        }
-        data = new Data(rsComm, path.c_str());
-        data->resource = resc;
+        archive_write_set_format_pax(a);
         if (archive_write_open(a, data, &a_creat, &a_write, &a_close) != ARCHIVE_OK) {
             delete data;
             archive_write_free(a);
@@ -105,6 +161,125 @@ class Archive
         return new Archive(a, data, true, json_array(), 0, path, collection, resc, "");
     }
 
+    /*
+     * Open an existing archive to append new items to. This is only possible
+     * for uncompressed tar archives: new members are written after the last
+     * member, and INDEX.json is rewritten in place, which requires that the
+     * new index fits in the space reserved for it when the archive was
+     * created.
+     */
+    static Archive* append(rsComm_t* rsComm, std::string path, std::string collection, const char* resc)
+    {
+        struct archive* a;
+        Data* data;
+        Archive* archive;
+        json_t *list, *json, *attributeSets, *aclSets, *origins, *source;
+        size_t dataSize, indexSize;
+        rodsLong_t indexOffset, end;
+        bool cbor;
+        int version;
+
+        if (path.length() < 4 || path.compare(path.length() - 4, 4, ".tar") != 0) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: can only append to uncompressed tar archives");
+            return NULL;
+        }
+
+        /*
+         * obtain the current index
+         */
+        archive = open(rsComm, path, NULL);
+        if (archive == NULL) {
+            return NULL;
+        }
+        if (archive->origin.compare(collection) != 0) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: archive %s was created from another collection", path.c_str());
+            delete archive;
+            return NULL;
+        }
+        list = json_incref(archive->list);
+        dataSize = archive->dataSize;
+        cbor = Cbor::isCbor(archive->indexString);
+        version = archive->version;
+        attributeSets = json_incref(archive->attributeSets);
+        aclSets = json_incref(archive->aclSets);
+        origins = json_incref(archive->origins);
+        delete archive;
+
+        /*
+         * find INDEX.json and the end of the last member
+         */
+        data = new Data(rsComm, path.c_str());
+        data->index = _open(data, path.c_str(), O_RDWR);
+        if (data->index < 0 || _tarScan(rsComm, data->index, &indexOffset, &indexSize, &end) < 0 ||
+            _seek(rsComm, data->index, end) != end)
+        {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: cannot append to %s", path.c_str());
+            if (data->index >= 0) {
+                _close(rsComm, data->index);
+            }
+            json_decref(list);
+            json_decref(attributeSets);
+            json_decref(aclSets);
+            json_decref(origins);
+            delete data;
+            return NULL;
+        }
+
+        a = archive_write_new();
+        if (a == NULL) {
+            _close(rsComm, data->index);
+            json_decref(list);
+            json_decref(attributeSets);
+            json_decref(aclSets);
+            json_decref(origins);
+            delete data;
+            return NULL;
+        }
+        archive_write_set_format_pax(a);
+        if (archive_write_open(a, data, NULL, &a_write, &a_keep) != ARCHIVE_OK) {
+            archive_write_free(a);
+            _close(rsComm, data->index);
+            json_decref(list);
+            json_decref(attributeSets);
+            json_decref(aclSets);
+            json_decref(origins);
+            delete data;
+            return NULL;
+        }
+
+        archive = new Archive(a, data, true, list, dataSize, path, collection, resc, "");
+        archive->reserve = indexSize;
+        archive->base = end;
+        archive->cbor = cbor; /* the index is rewritten in the same format */
+        archive->version = version; /* and the same version */
+        archive->indexOffset = indexOffset;
+        for (size_t i = 0; i < json_array_size(list); i++) {
+            json = json_array_get(list, i);
+            archive->existing[json_string_value(json_object_get(json, "name"))] = json;
+
+            /*
+             * renumber the attribute sets and ACLs of existing items
+             */
+            archive->update(json,
+                            json_incref(resolve(json_object_get(json, "attributes"), attributeSets)),
+                            json_incref(resolve(json_object_get(json, "ACL"), aclSets)));
+
+            /*
+             * and their origins
+             */
+            source = resolve(json_object_get(json, "origin"), origins);
+            if (json_is_string(source)) {
+                json_object_set_new(json,
+                                    "origin",
+                                    json_integer(archive->table.internOrigin(json_string_value(source))));
+            }
+        }
+        json_decref(attributeSets);
+        json_decref(aclSets);
+        json_decref(origins);
+        return archive;
+    }
+
     /*
      * open existing archive
      */
@@ -114,11 +289,10 @@ class Archive
         Data* data;
         struct archive_entry* entry;
         size_t size;
-        char* buf;
-        json_t *json, *list;
-        json_error_t error;
-        std::string origin;
-        Archive* archive;
+        __LA_SSIZE_T len;
+        json_t* json;
+        rodsObjStat_t* objStat;
+        IndexCache cache;
 
         /*
          * open any archive
@@ -133,48 +307,122 @@ class Archive
         if (archive_read_open(a, data, &a_open, &a_read, &a_close) != ARCHIVE_OK ||
             archive_read_next_header(a, &entry) != ARCHIVE_OK)
         {
-            delete data;
             archive_read_free(a);
+            delete data;
             return NULL;
         }
 
         /*
-         * the archive must have INDEX.json as its first entry
+         * the archive must have INDEX.json or INDEX.cbor as its first entry
          */
-        if (strcmp(archive_entry_pathname(entry), "INDEX.json") != 0) {
-            delete data;
+        if (strcmp(archive_entry_pathname(entry), A_INDEX) != 0 &&
+            strcmp(archive_entry_pathname(entry), A_INDEXCBOR) != 0)
+        {
             archive_read_free(a);
+            delete data;
             return NULL;
         }
 
         /*
-         * retrieve and load INDEX.json
+         * retrieve and load the index; the size of a zip entry that is
+         * followed by a data descriptor is not known in advance
          */
-        size = (size_t) archive_entry_size(entry);
-        buf = new char[size + 1];
-        buf[size] = '\0';
-        if (archive_read_data(a, buf, size) != (__LA_SSIZE_T) size || (json = json_loads(buf, 0, &error)) == NULL) {
-            delete buf;
-            delete data;
+        std::string buf;
+        if (archive_entry_size_is_set(entry)) {
+            size = (size_t) archive_entry_size(entry);
+            buf.resize(size);
+            len = (size != 0) ? archive_read_data(a, &buf[0], size) : 0;
+        }
+        else {
+            size = 0;
+            do {
+                buf.resize(size + A_BLOCKSIZE);
+                len = archive_read_data(a, &buf[size], A_BLOCKSIZE);
+                size += (len > 0) ? (size_t) len : 0;
+            } while (len > 0);
+            buf.resize(size);
+            len = (len == 0) ? (__LA_SSIZE_T) size : -1;
+        }
+        if (len != (__LA_SSIZE_T) size || (json = parseIndex(buf)) == NULL) {
             archive_read_free(a);
+            delete data;
             return NULL;
         }
 
         /*
-         * obtain list of items from INDEX.json
+         * remember the index for later queries, in binary form
          */
-        origin = json_string_value(json_object_get(json, "collection"));
-        size = (size_t) json_integer_value(json_object_get(json, "size"));
-        list = json_object_get(json, "items");
-        json_incref(list);
-        json_decref(json);
+        objStat = _stat(rsComm, path.c_str());
+        if (!cache.contains(IndexCache::key(objStat))) {
+            cache.put(IndexCache::key(objStat), Cbor::isCbor(buf) ? buf : Cbor::encode(json));
+        }
+        if (objStat != NULL) {
+            freeRodsObjStat(objStat);
+        }
+
+        return load(a, data, path, resc, json, buf);
+    }
+
+    /*
+     * Open the index of an existing archive. The index is taken from the
+     * cache or from the sidecar index if possible, so that the archive
+     * itself does not have to be read. Items cannot be extracted from the
+     * result.
+     */
+    static Archive* openIndex(rsComm_t* rsComm, std::string path)
+    {
+        rodsObjStat_t* objStat;
+        std::string key, index;
+        json_t *json, *stamp;
+        json_error_t error;
+        IndexCache cache;
+
+        objStat = _stat(rsComm, path.c_str());
+        if (objStat == NULL) {
+            return NULL;
+        }
+        key = IndexCache::key(objStat);
+        json = NULL;
 
         /*
-         * safe to call the constructor
+         * the archive is not opened here, so check that the caller could
+         * have read it before handing out its index
          */
-        archive = new Archive(a, data, false, list, size, path, origin, resc, buf);
-        delete buf;
-        return archive;
+        if (!_readable(rsComm, objStat)) {
+            freeRodsObjStat(objStat);
+            return NULL;
+        }
+
+        if (cache.get(key, index)) {
+            json = parseIndex(index);
+        }
+        else if (readObject(rsComm, (path + A_SIDECAR).c_str(), index) >= 0 &&
+                 (json = json_loads(index.c_str(), 0, &error)) != NULL)
+        {
+            /*
+             * only use the sidecar index if it was written for this very
+             * version of the archive
+             */
+            stamp = json_object_get(json, "archive");
+            if (json_integer_value(json_object_get(stamp, "size")) == objStat->objSize &&
+                json_string_value(json_object_get(stamp, "modified")) != NULL &&
+                strcmp(json_string_value(json_object_get(stamp, "modified")), objStat->modifyTime) == 0)
+            {
+                json_object_del(json, "archive");
+                index = Cbor::encode(json);
+                cache.put(key, index);
+            }
+            else {
+                json_decref(json);
+                json = NULL;
+            }
+        }
+        freeRodsObjStat(objStat);
+
+        if (json != NULL) {
+            return load(NULL, new Data(rsComm, path.c_str()), path, NULL, json, index);
+        }
+        return open(rsComm, path, NULL);
     }
 
     /*
@@ -182,9 +430,19 @@ class Archive
      */
     ~Archive()
     {
+        if (creating && isZip(path) && data->index >= 0) {
+            /*
+             * zip archive that was not completed
+             */
+            delete zip;
+            _close(data->rsComm, data->index);
+        }
         if (archive != NULL) {
             if (creating) {
                 archive_write_free(archive);
+                if (indexOffset >= 0) {
+                    _close(data->rsComm, data->index);
+                }
             }
             else {
                 archive_read_free(archive);
@@ -192,12 +450,20 @@ class Archive
         }
 
         json_decref(list);
+        json_decref(attributeSets);
+        json_decref(aclSets);
+        json_decref(origins);
         delete data;
     }
 
     /*
      * Add a DataObj to an archive.  It will be added to the index at first,
-     * the actual archive will be created when construct() is called.
+     * the actual archive will be created when construct() is called.  The
+     * references to attributes and acl are taken over.  If given, the
+     * replica on the resource hierarchy is read, and the DataObjs can be
+     * ordered by the physical paths of their replicas. The name is relative
+     * to the parent collection if given, else to the collection of the
+     * archive.
      */
     void addDataObj(std::string name,
                     size_t size,
@@ -207,36 +473,67 @@ class Archive
                     std::string zone,
                     std::string checksum,
                     json_t* attributes,
-                    json_t* acl)
+                    json_t* acl,
+                    const char* resource = NULL,
+                    const char* location = NULL,
+                    const char* parent = NULL)
     {
-        if (path.compare(origin + "/" + name) != 0) {
+        std::string source;
+
+        source = ((parent != NULL) ? parent : origin) + "/" + name;
+        if (path.compare(source) != 0 && (path + A_SIDECAR).compare(source) != 0 &&
+            (path + A_JOBSUFFIX).compare(source) != 0)
+        {
             json_t* json;
 
-            json = json_object();
-            json_object_set_new(json, "name", json_string(name.c_str()));
-            json_object_set_new(json, "type", json_string("dataObj"));
-            json_object_set_new(json, "size", json_integer((json_int_t) size));
-            json_object_set_new(json, "created", json_integer(created));
-            json_object_set_new(json, "modified", json_integer(modified));
-            json_object_set_new(json, "owner", json_string((owner + "#" + zone).c_str()));
-            if (checksum.length() != 0) {
-                json_object_set_new(json, "checksum", json_string(checksum.c_str()));
-            }
-            if (attributes != NULL) {
-                json_object_set(json, "attributes", attributes);
-            }
-            if (acl != NULL) {
-                json_object_set(json, "ACL", acl);
+            if (indexOffset >= 0) {
+                /*
+                 * appending: only add new or modified DataObjs
+                 */
+                auto item = existing.find(name);
+                if (item != existing.end()) {
+                    json = item->second;
+                    if (json_integer_value(json_object_get(json, "size")) == (json_int_t) size &&
+                        json_integer_value(json_object_get(json, "modified")) == modified &&
+                        checksum.compare(json_object_get(json, "checksum") != NULL
+                                             ? json_string_value(json_object_get(json, "checksum"))
+                                             : "") == 0)
+                    {
+                        update(json, attributes, acl);
+                        return;
+                    }
+                    json_object_set_new(json, "superseded", json_true());
+                    dataSize -= ((size_t) json_integer_value(json_object_get(json, "size")) + A_BLOCKSIZE - 1) &
+                                ~(A_BLOCKSIZE - 1);
+                }
             }
-            json_array_append_new(list, json);
 
+            table.add(name,
+                      checksum.c_str(),
+                      size,
+                      created,
+                      modified,
+                      owner,
+                      zone,
+                      attributes,
+                      acl,
+                      resource,
+                      location,
+                      parent);
             dataSize += (size + A_BLOCKSIZE - 1) & ~(A_BLOCKSIZE - 1);
         }
+        else {
+            json_decref(attributes);
+            json_decref(acl);
+        }
     }
 
     /*
      * Add a collection to an archive.  It will be added to the index at first,
-     * the actual archive will be created when construct() is called.
+     * the actual archive will be created when construct() is called.  The
+     * references to attributes and acl are taken over.  The name is relative
+     * to the parent collection if given, else to the collection of the
+     * archive.
      */
     void addColl(std::string name,
                  time_t created,
@@ -244,23 +541,21 @@ class Archive
                  std::string owner,
                  std::string zone,
                  json_t* attributes,
-                 json_t* acl)
+                 json_t* acl,
+                 const char* parent = NULL)
     {
-        json_t* json;
-
-        json = json_object();
-        json_object_set_new(json, "name", json_string(name.c_str()));
-        json_object_set_new(json, "type", json_string("coll"));
-        json_object_set_new(json, "created", json_integer(created));
-        json_object_set_new(json, "modified", json_integer(modified));
-        json_object_set_new(json, "owner", json_string((owner + "#" + zone).c_str()));
-        if (attributes != NULL) {
-            json_object_set(json, "attributes", attributes);
-        }
-        if (acl != NULL) {
-            json_object_set(json, "ACL", acl);
+        if (indexOffset >= 0) {
+            /*
+             * appending: only add new collections
+             */
+            auto item = existing.find(name);
+            if (item != existing.end()) {
+                update(item->second, attributes, acl);
+                return;
+            }
         }
-        json_array_append_new(list, json);
+
+        table.add(name, NULL, 0, created, modified, owner, zone, attributes, acl, NULL, NULL, parent);
     }
 
     /*
@@ -269,58 +564,78 @@ class Archive
     int construct()
     {
         if (creating) {
-            json_t* json;
-            char* str;
             __LA_SSIZE_T len;
+            size_t done, total;
+            int status;
 
             /*
-             * first entry, INDEX.json
+             * the index lists the items in the order in which they are
+             * written
              */
-            json = json_object();
-            json_object_set_new(json, "collection", json_string(origin.c_str()));
-            json_object_set_new(json, "size", json_integer((json_int_t) dataSize));
-            json_object_set(json, "items", list);
-            str = json_dumps(json, JSON_INDENT(2));
-            json_decref(json);
+            table.sort(order);
 
-            len = (__LA_SSIZE_T) strlen(str);
-            entry = archive_entry_new();
-            archive_entry_set_pathname(entry, "INDEX.json");
-            archive_entry_set_filetype(entry, AE_IFREG);
-            archive_entry_set_perm(entry, 0444);
-            archive_entry_set_size(entry, len);
-            if (archive_write_header(archive, entry) < ARCHIVE_OK ||
-                archive_write_data(archive, str, (size_t) len) < ARCHIVE_OK)
-            {
-                rodsLog(LOG_ERROR, "msiArchiveCreate: %s", archive_error_string(archive));
-                free(str);
-                return SYS_TAR_APPEND_ERR;
+            /*
+             * first entry, INDEX.json, padded to the reserved size
+             */
+            std::string indexStr = dumpIndex(JSON_INDENT(2), NULL, cbor);
+            if (indexStr.length() < reserve) {
+                if (cbor) {
+                    indexStr.append(reserve - indexStr.length(), '\0');
+                }
+                else {
+                    indexStr.append(reserve - indexStr.length() - 1, ' ');
+                    indexStr.append("\n");
+                }
+            }
+
+            len = (__LA_SSIZE_T) indexStr.length();
+            if (indexOffset >= 0) {
+                /*
+                 * appending: the index is rewritten in place afterwards
+                 */
+                if ((size_t) len > reserve) {
+                    rodsLog(LOG_ERROR,
+                            "msiArchiveCreate: index of %s does not fit in the reserved %zu bytes",
+                            path.c_str(),
+                            reserve);
+                    return SYS_TAR_APPEND_ERR;
+                }
+            }
+            else {
+                if (isZip(path)) {
+                    zip = new ZipWriter(
+                        [this](const void* buf, size_t len) {
+                            int status = _write(data->rsComm, data->index, buf, len);
+                            return (status < 0 || (size_t) status == len) ? status : SYS_COPY_LEN_ERR;
+                        },
+                        threads,
+                        2 * threads);
+                }
+                if (writeHeader(cbor ? A_INDEXCBOR : A_INDEX, false, time(NULL), (size_t) len, 0444, true) < 0 ||
+                    writeData(indexStr.c_str(), (size_t) len) < 0 || finishEntry() < 0)
+                {
+                    return SYS_TAR_APPEND_ERR;
+                }
             }
-            free(str);
 
             /*
              * now add the DataObjs and collections
              */
-            for (index = 0; index < json_array_size(list); index++) {
+            for (index = 0, done = 0, total = 0; index < table.size(); index++) {
+                total += table.dataSize(index);
+            }
+            for (index = 0; index < table.size(); index++) {
                 const char* filename;
                 int fd;
                 size_t size;
-                time_t mtime;
-
-                entry = archive_entry_new();
-                json = json_array_get(list, index);
-                filename = json_string_value(json_object_get(json, "name"));
-                mtime = json_integer_value(json_object_get(json, "modified"));
-                archive_entry_set_pathname(entry, filename);
-                archive_entry_set_mtime(entry, mtime, 0);
-                if (strcmp(json_string_value(json_object_get(json, "type")), "coll") == 0) {
+                bool deflate;
+
+                filename = table.name(index);
+                if (table.isColl(index)) {
                     /*
                      * collection
                      */
-                    archive_entry_set_filetype(entry, AE_IFDIR);
-                    archive_entry_set_perm(entry, 0750);
-                    if (archive_write_header(archive, entry) < ARCHIVE_OK) {
-                        rodsLog(LOG_ERROR, "msiArchiveCreate: %s", archive_error_string(archive));
+                    if (writeHeader(filename, true, table.modified(index), 0, 0750, false) < 0) {
                         return SYS_TAR_APPEND_ERR;
                     }
                 }
@@ -328,21 +643,38 @@ class Archive
                     /*
                      * DataObj
                      */
-                    archive_entry_set_filetype(entry, AE_IFREG);
-                    archive_entry_set_perm(entry, 0600);
-                    size = (size_t) json_integer_value(json_object_get(json, "size"));
-                    archive_entry_set_size(entry, (__LA_INT64_T) size);
-                    if (archive_write_header(archive, entry) < ARCHIVE_OK) {
-                        rodsLog(LOG_ERROR, "msiArchiveCreate: %s", archive_error_string(archive));
-                        return SYS_TAR_APPEND_ERR;
-                    }
-                    fd = _open(data, (origin + "/" + filename).c_str());
+                    size = table.dataSize(index);
+                    const std::string& hier = table.resourceHierarchy(index);
+                    std::string parent = table.origin(index);
+                    fd = _open(data,
+                               ((parent.empty() ? origin : parent) + "/" + filename).c_str(),
+                               O_RDONLY,
+                               hier.empty() ? NULL : hier.c_str());
                     if (fd < 0) {
                         return fd;
                     }
-                    while ((len = _read(data->rsComm, fd, data->buf, sizeof(data->buf))) > 0) {
-                        if (archive_write_data(archive, data->buf, (size_t) len) < ARCHIVE_OK) {
-                            rodsLog(LOG_ERROR, "msiArchiveCreate: %s", archive_error_string(archive));
+
+                    /*
+                     * the first block is read before the header is written,
+                     * to choose the compression of a zip entry
+                     */
+                    len = _read(data->rsComm, fd, data->buf, sizeof(data->buf));
+                    deflate = (compression == COMPRESS_DEFLATE ||
+                               (compression == COMPRESS_AUTO &&
+                                (len <= 0 || compressible(filename, data->buf, (size_t) len))));
+                    if (writeHeader(filename, false, table.modified(index), size, 0600, deflate) < 0) {
+                        _close(data->rsComm, fd);
+                        return SYS_TAR_APPEND_ERR;
+                    }
+                    if (!isZip(path)) {
+                        /*
+                         * members are stored as is, so they can be read
+                         * directly from the archive later
+                         */
+                        table.setOffset(index, base + archive_filter_bytes(archive, 0));
+                    }
+                    for (; len > 0; len = _read(data->rsComm, fd, data->buf, sizeof(data->buf))) {
+                        if (writeData(data->buf, (size_t) len) < 0) {
                             _close(data->rsComm, fd);
                             return SYS_TAR_APPEND_ERR;
                         }
@@ -353,111 +685,1082 @@ class Archive
                         return SYS_TAR_APPEND_ERR;
                     }
                     _close(data->rsComm, fd);
+                    if (finishEntry() < 0) {
+                        return SYS_TAR_APPEND_ERR;
+                    }
+                    done += size;
+                }
+
+                if (progress) {
+                    status = progress(index + 1, table.size(), done, total);
+                    if (status < 0) {
+                        return status;
+                    }
+                }
+            }
+
+            if (indexOffset >= 0) {
+                /*
+                 * all new members are written, now replace the index
+                 */
+                if (archive_write_close(archive) != ARCHIVE_OK ||
+                    _seek(data->rsComm, data->index, indexOffset) != indexOffset ||
+                    _write(data->rsComm, data->index, indexStr.c_str(), indexStr.length()) != (int) indexStr.length())
+                {
+                    rodsLog(LOG_ERROR, "msiArchiveCreate: failed to update the index of %s", path.c_str());
+                    return SYS_TAR_APPEND_ERR;
+                }
+                archive_write_free(archive);
+                archive = NULL;
+                status = _close(data->rsComm, data->index);
+                if (status >= 0) {
+                    cacheIndex();
+                }
+                return status;
+            }
+
+            if (zip != NULL) {
+                /*
+                 * write the central directory
+                 */
+                status = zip->close();
+                delete zip;
+                zip = NULL;
+                if (status < 0) {
+                    rodsLog(LOG_ERROR, "msiArchiveCreate: failed to write %s", path.c_str());
+                    return SYS_TAR_APPEND_ERR;
                 }
+                status = _close(data->rsComm, data->index);
+                data->index = -1;
+                return status;
             }
 
-            archive_write_free(archive);
+            if (archive_write_free(archive) != ARCHIVE_OK) {
+                archive = NULL;
+                return SYS_TAR_APPEND_ERR;
+            }
             archive = NULL;
+            cacheIndex();
         }
 
         return 0;
     }
 
     /*
-     * return INDEX.json as a string
+     * Cache the index of a tar archive just written. Unlike INDEX.json in
+     * the archive, it includes the offsets of the members, so that they
+     * can be read directly.
      */
-    std::string indexItems()
+    void cacheIndex()
     {
-        return indexString;
+        rodsObjStat_t* objStat;
+
+        objStat = _stat(data->rsComm, path.c_str());
+        if (objStat != NULL) {
+            IndexCache().put(IndexCache::key(objStat), dumpIndex(0, NULL, true));
+            freeRodsObjStat(objStat);
+        }
     }
 
     /*
-     * return size in blocks of items once extracted
+     * Reserve space for INDEX.json in a new archive, so that items can be
+     * appended later without rewriting the archive.
      */
-    size_t size()
+    void reserveIndex(size_t size)
     {
-        return dataSize;
+        if (indexOffset < 0) {
+            reserve = size;
+        }
     }
 
     /*
-     * get metadata of next item (potentially skipping current) from archive
+     * Write the index as INDEX.cbor in binary form, which loads faster than
+     * INDEX.json.
      */
-    json_t* nextItem()
+    void binaryIndex(bool cbor)
     {
-        if (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-            return json_array_get(list, index++);
-        }
-        else {
-            return NULL;
+        if (indexOffset < 0) {
+            this->cbor = cbor;
         }
     }
 
     /*
-     * extract current item under the given filename
+     * Set the compression of the DataObjs in a zip archive. By default,
+     * DataObjs that are already compressed are stored as is.
      */
-    int extractItem(std::string filename)
+    void zipCompression(int compression)
     {
-        if (archive_entry_filetype(entry) == AE_IFDIR) {
-            collInp_t collCreateInp;
-            int err;
+        this->compression = compression;
+    }
 
-            /*
-             * collection
-             */
-            memset(&collCreateInp, '\0', sizeof(collInp_t));
-            rstrcpy(collCreateInp.collName, filename.c_str(), MAX_NAME_LEN);
-            err = rsCollCreate(data->rsComm, &collCreateInp);
-            return (err == CATALOG_ALREADY_HAS_ITEM_BY_THAT_NAME) ? 0 : err;
-        }
-        else {
-            char buf[A_BUFSIZE];
-            int fd, status;
-            __LA_SSIZE_T len;
+    /*
+     * Set the number of threads that compress the DataObjs in a zip
+     * archive.
+     */
+    void compressionThreads(size_t threads)
+    {
+        this->threads = (threads != 0) ? threads : 1;
+    }
 
-            /*
-             * DataObj
-             */
-            fd = _creat(data, filename.c_str());
-            if (fd < 0) {
-                return fd;
-            }
-            while ((len = archive_read_data(archive, buf, sizeof(buf))) > 0) {
-                status = _write(data->rsComm, fd, buf, (size_t) len);
-                if (status < 0) {
-                    _close(data->rsComm, fd);
-                    return status;
-                }
-            }
-            if (len < 0) {
-                _close(data->rsComm, fd);
-                return SYS_TAR_EXTRACT_ALL_ERR;
-            }
-            return _close(data->rsComm, fd);
-        }
+    /*
+     * Set a function to call after each item written by construct(), with
+     * the number of items and bytes done and to do. Construction stops if
+     * it returns a negative status.
+     */
+    void onProgress(std::function<int(size_t, size_t, size_t, size_t)> progress)
+    {
+        this->progress = progress;
+    }
 
-        return 0;
+    /*
+     * Set the order in which new DataObjs are read and written. Reading
+     * replicas in the order of their physical paths avoids seeking on disk
+     * and tape resources; ordering by size class tends to compress better.
+     */
+    void orderBy(int order)
+    {
+        this->order = order;
     }
 
-  private:
     /*
-     * create an iRODS DataObj
+     * order in which new DataObjs are written
      */
-    static int _creat(Data* data, const char* name)
+    int ordering()
     {
-        int fd;
+        return order;
+    }
 
-        /*
-         * workaround for https://github.com/irods/irods/issues/4692:
-         * don't use forceFlag with create
-         */
-        memset(&data->create, '\0', sizeof(dataObjInp_t));
-        data->create.openFlags = O_WRONLY | O_TRUNC;
-        if (data->resource != NULL) {
-            addKeyVal(&data->create.condInput, DEST_RESC_NAME_KW, data->resource);
-        }
-        addKeyVal(&data->create.condInput, TRANSLATED_PATH_KW, "");
-        rstrcpy(data->create.objPath, name, MAX_NAME_LEN);
-        fd = rsDataObjOpen(data->rsComm, &data->create);
+    /*
+     * Set the format of the index to write. Version 1 includes attributes
+     * and ACLs with every item, for readers that do not support version 2.
+     */
+    void indexVersion(int version)
+    {
+        this->version = version;
+    }
+
+    /*
+     * Write the index as a separate DataObj next to the archive, so that it
+     * can be read without accessing the archive. The catalog size and
+     * modification time of the archive are included to detect whether the
+     * sidecar index still matches the archive.
+     */
+    int sidecar(const char* resc)
+    {
+        rodsObjStat_t* objStat;
+        json_t* stamp;
+        int status;
+
+        objStat = _stat(data->rsComm, path.c_str());
+        if (objStat == NULL) {
+            return OBJ_PATH_DOES_NOT_EXIST;
+        }
+        stamp = json_object();
+        json_object_set_new(stamp, "size", json_integer((json_int_t) objStat->objSize));
+        json_object_set_new(stamp, "modified", json_string(objStat->modifyTime));
+
+        std::string str = dumpIndex(0, stamp, false);
+        json_decref(stamp);
+        freeRodsObjStat(objStat);
+
+        status = writeObject(data->rsComm, (path + A_SIDECAR).c_str(), resc, str.c_str(), str.length());
+        if (status < 0) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: failed to write sidecar index for %s", path.c_str());
+        }
+        return status;
+    }
+
+    /*
+     * write a small DataObj in one go
+     */
+    static int writeObject(rsComm_t* rsComm, const char* name, const char* resc, const char* buf, size_t len)
+    {
+        Data* d;
+        int fd, status;
+        size_t done;
+
+        d = new Data(rsComm, name);
+        d->resource = resc;
+        fd = _creat(d, name);
+        if (fd < 0) {
+            delete d;
+            return fd;
+        }
+        for (done = 0, status = 0; done < len && status >= 0; done += (size_t) status) {
+            status = _write(rsComm, fd, buf + done, std::min(len - done, (size_t) A_BUFSIZE));
+        }
+        if (status < 0) {
+            _close(rsComm, fd);
+        }
+        else {
+            status = _close(rsComm, fd);
+        }
+        delete d;
+        return status;
+    }
+
+    /*
+     * read a small DataObj in one go
+     */
+    static int readObject(rsComm_t* rsComm, const char* name, std::string& str)
+    {
+        Data* d;
+        int fd, len;
+
+        d = new Data(rsComm, name);
+        fd = _open(d, name);
+        if (fd < 0) {
+            delete d;
+            return fd;
+        }
+        str.clear();
+        while ((len = _read(rsComm, fd, d->buf, sizeof(d->buf))) > 0) {
+            str.append(d->buf, (size_t) len);
+        }
+        _close(rsComm, fd);
+        delete d;
+        return len;
+    }
+
+    /*
+     * Return INDEX.json as a string, also for a binary index. A version 2
+     * index is returned in the version 1 format, with the attributes, ACL
+     * and origin included in every item, so that callers need not resolve
+     * them.
+     */
+    std::string indexItems()
+    {
+        json_t *json, *items;
+        char* str;
+
+        if (!Cbor::isCbor(indexString) && version < 2) {
+            return indexString;
+        }
+        json = parseIndex(indexString);
+        if (json == NULL) {
+            return "";
+        }
+        if (version >= 2) {
+            items = json_object_get(json, "items");
+            for (size_t i = 0; i < json_array_size(items); i++) {
+                resolveItem(json_array_get(items, i), json_array_get(items, i));
+            }
+            json_object_del(json, "version");
+            json_object_del(json, "attributeSets");
+            json_object_del(json, "ACLSets");
+            json_object_del(json, "origins");
+        }
+        str = json_dumps(json, JSON_INDENT(2));
+        json_decref(json);
+        std::string index = str;
+        free(str);
+        return index;
+    }
+
+    /*
+     * Return a page of INDEX.json as a string. Items are selected by name,
+     * either by prefix or by glob pattern, and reduced to the given
+     * comma-separated list of fields. A limit of 0 means no limit.
+     */
+    std::string queryItems(size_t offset, size_t limit, const char* filter, const char* fields)
+    {
+        json_t *json, *items, *item;
+        std::vector<std::string> select;
+        size_t i, total;
+        const char* name;
+        char* str;
+        bool glob;
+
+        while (fields != NULL && *fields != '\0') {
+            const char* end = strchr(fields, ',');
+            size_t len = (end != NULL) ? (size_t) (end - fields) : strlen(fields);
+
+            if (len != 0) {
+                select.push_back(std::string(fields, len));
+            }
+            fields = (end != NULL) ? end + 1 : NULL;
+        }
+        if (filter != NULL && *filter == '\0') {
+            filter = NULL;
+        }
+        glob = (filter != NULL && strpbrk(filter, "*?[") != NULL);
+
+        items = json_array();
+        total = 0;
+        for (i = 0; i < json_array_size(list); i++) {
+            json = json_array_get(list, i);
+            if (json_is_true(json_object_get(json, "superseded"))) {
+                continue;
+            }
+            if (filter != NULL) {
+                name = json_string_value(json_object_get(json, "name"));
+                if (glob ? fnmatch(filter, name, 0) != 0 : strncmp(name, filter, strlen(filter)) != 0) {
+                    continue;
+                }
+            }
+
+            /*
+             * count all matching items, but only return the requested page
+             */
+            if (total++ < offset || (limit != 0 && total > offset + limit)) {
+                continue;
+            }
+            if (select.empty() && version < 2) {
+                json_array_append(items, json);
+            }
+            else {
+                /*
+                 * selected fields, with attributes and ACL included
+                 */
+                item = json_object();
+                if (select.empty()) {
+                    json_object_update(item, json);
+                }
+                else {
+                    for (auto field = select.begin(); field != select.end(); field++) {
+                        json_t* value = json_object_get(json, field->c_str());
+                        if (value != NULL) {
+                            json_object_set(item, field->c_str(), value);
+                        }
+                    }
+                }
+                resolveItem(item, json);
+                json_array_append_new(items, item);
+            }
+        }
+
+        json = json_object();
+        json_object_set_new(json, "collection", json_string(origin.c_str()));
+        json_object_set_new(json, "size", json_integer((json_int_t) dataSize));
+        json_object_set_new(json, "total", json_integer((json_int_t) total));
+        json_object_set_new(json, "offset", json_integer((json_int_t) offset));
+        json_object_set_new(json, "items", items);
+        str = json_dumps(json, 0);
+        json_decref(json);
+
+        std::string result = str;
+        free(str);
+        return result;
+    }
+
+    /*
+     * return size in blocks of items once extracted
+     */
+    size_t size()
+    {
+        return dataSize;
+    }
+
+    /*
+     * get metadata of next item (potentially skipping current) from archive
+     */
+    json_t* nextItem()
+    {
+        if (archive != NULL && archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+            return json_array_get(list, index++);
+        }
+        else {
+            return NULL;
+        }
+    }
+
+    /*
+     * return the list of items in INDEX.json
+     */
+    json_t* items()
+    {
+        return list;
+    }
+
+    /*
+     * return the attributes of an item in INDEX.json, or NULL
+     */
+    json_t* attributes(json_t* item)
+    {
+        return resolve(json_object_get(item, "attributes"), attributeSets);
+    }
+
+    /*
+     * return the ACL of an item in INDEX.json, or NULL
+     */
+    json_t* acl(json_t* item)
+    {
+        return resolve(json_object_get(item, "ACL"), aclSets);
+    }
+
+    /*
+     * return the collection that the name of an item in INDEX.json is
+     * relative to, or NULL for the collection of the archive
+     */
+    json_t* source(json_t* item)
+    {
+        return resolve(json_object_get(item, "origin"), origins);
+    }
+
+    /*
+     * replace the references to attributes, ACL and origin in a copy of an
+     * item in INDEX.json with the values themselves
+     */
+    void resolveItem(json_t* copy, json_t* item)
+    {
+        if (json_object_get(copy, "attributes") != NULL) {
+            json_object_set(copy, "attributes", attributes(item));
+        }
+        if (json_object_get(copy, "ACL") != NULL) {
+            json_object_set(copy, "ACL", acl(item));
+        }
+        if (json_object_get(copy, "origin") != NULL) {
+            json_object_set(copy, "origin", source(item));
+        }
+    }
+
+    /*
+     * find the current version of an item in the index, or NULL
+     */
+    json_t* item(const char* name)
+    {
+        json_t* json;
+        size_t i;
+
+        for (i = json_array_size(list); i > 0; i--) {
+            json = json_array_get(list, i - 1);
+            if (strcmp(json_string_value(json_object_get(json, "name")), name) == 0 &&
+                !json_is_true(json_object_get(json, "superseded")))
+            {
+                return json;
+            }
+        }
+        return NULL;
+    }
+
+    /*
+     * Read part of a DataObj directly from its offset in the archive, if
+     * the index has it. Return the number of bytes read, or a negative
+     * status.
+     */
+    int readAt(json_t* item, size_t offset, size_t length, char* buf)
+    {
+        char header[A_TARBLOCK];
+        rodsLong_t start;
+        size_t done;
+        int fd, len;
+
+        if (!json_is_integer(json_object_get(item, "offset"))) {
+            return SYS_NOT_SUPPORTED;
+        }
+        start = json_integer_value(json_object_get(item, "offset"));
+        len = 0;
+        fd = _open(data, path.c_str());
+        if (fd < 0) {
+            return fd;
+        }
+
+        /*
+         * make sure that the offset points just after the header of this
+         * very member, and not of another file
+         */
+        if (start < A_TARBLOCK || _seek(data->rsComm, fd, start - A_TARBLOCK) != start - A_TARBLOCK ||
+            _read(data->rsComm, fd, header, A_TARBLOCK) != A_TARBLOCK ||
+            !isHeader(header,
+                      json_string_value(json_object_get(item, "name")),
+                      (rodsLong_t) json_integer_value(json_object_get(item, "size"))) ||
+            _seek(data->rsComm, fd, start + (rodsLong_t) offset) != start + (rodsLong_t) offset)
+        {
+            _close(data->rsComm, fd);
+            return SYS_TAR_EXTRACT_ALL_ERR;
+        }
+
+        for (done = 0; done < length; done += (size_t) len) {
+            len = _read(data->rsComm, fd, buf + done, std::min(length - done, (size_t) A_BUFSIZE));
+            if (len <= 0) {
+                break;
+            }
+        }
+        _close(data->rsComm, fd);
+        return (len < 0) ? len : (int) done;
+    }
+
+    /*
+     * advance to the entry of an item in the archive
+     */
+    bool findEntry(json_t* item)
+    {
+        json_t* json;
+
+        while ((json = nextItem()) != NULL) {
+            if (json == item) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Advance to the next entry of the archive regardless of the index,
+     * return its pathname or NULL at the end of the archive.
+     */
+    const char* nextEntry()
+    {
+        if (archive != NULL && archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+            index++;
+            return archive_entry_pathname(entry);
+        }
+        return NULL;
+    }
+
+    /*
+     * is the current entry a collection?
+     */
+    bool isColl()
+    {
+        return (archive_entry_filetype(entry) == AE_IFDIR);
+    }
+
+    /*
+     * read data from the current entry, return the length read, 0 at the
+     * end of the entry or a negative value on error
+     */
+    __LA_SSIZE_T readEntry(void* buf, size_t len)
+    {
+        __LA_SSIZE_T status;
+
+        status = archive_read_data(archive, buf, len);
+        if (status < 0) {
+            rodsLog(LOG_ERROR, "Archive: %s", archive_error_string(archive));
+        }
+        return status;
+    }
+
+    /*
+     * extract current item under the given filename, optionally on a given
+     * resource rather than the default one
+     */
+    int extractItem(std::string filename, const char* resc = NULL)
+    {
+        if (archive_entry_filetype(entry) == AE_IFDIR) {
+            collInp_t collCreateInp;
+            int err;
+
+            /*
+             * collection
+             */
+            memset(&collCreateInp, '\0', sizeof(collInp_t));
+            rstrcpy(collCreateInp.collName, filename.c_str(), MAX_NAME_LEN);
+            err = rsCollCreate(data->rsComm, &collCreateInp);
+            return (err == CATALOG_ALREADY_HAS_ITEM_BY_THAT_NAME) ? 0 : err;
+        }
+        else {
+            char buf[A_BUFSIZE];
+            int fd, status;
+            __LA_SSIZE_T len;
+
+            /*
+             * DataObj
+             */
+            if (resc != NULL) {
+                data->resource = resc;
+            }
+            fd = _creat(data, filename.c_str());
+            if (fd < 0) {
+                return fd;
+            }
+            while ((len = archive_read_data(archive, buf, sizeof(buf))) > 0) {
+                status = _write(data->rsComm, fd, buf, (size_t) len);
+                if (status < 0) {
+                    _close(data->rsComm, fd);
+                    return status;
+                }
+            }
+            if (len < 0) {
+                _close(data->rsComm, fd);
+                return SYS_TAR_EXTRACT_ALL_ERR;
+            }
+            return _close(data->rsComm, fd);
+        }
+
+        return 0;
+    }
+
+  private:
+    /*
+     * write the header of a new entry
+     */
+    int writeHeader(const char* name, bool dir, time_t modified, size_t size, int perm, bool deflate)
+    {
+        int status;
+
+        if (zip != NULL) {
+            return dir ? zip->addDirectory(name, modified) : zip->addFile(name, modified, size, deflate);
+        }
+        entry = archive_entry_new();
+        archive_entry_set_pathname(entry, name);
+        archive_entry_set_mtime(entry, modified, 0);
+        archive_entry_set_filetype(entry, dir ? AE_IFDIR : AE_IFREG);
+        archive_entry_set_perm(entry, (mode_t) perm);
+        if (!dir) {
+            archive_entry_set_size(entry, (__LA_INT64_T) size);
+        }
+        status = archive_write_header(archive, entry);
+        archive_entry_free(entry);
+        entry = NULL;
+        if (status < ARCHIVE_OK) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: %s", archive_error_string(archive));
+            return -1;
+        }
+        return 0;
+    }
+
+    /*
+     * write data of the current entry
+     */
+    int writeData(const void* buf, size_t len)
+    {
+        if (zip != NULL) {
+            return zip->write(buf, len);
+        }
+        if (archive_write_data(archive, buf, len) < ARCHIVE_OK) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: %s", archive_error_string(archive));
+            return -1;
+        }
+        return 0;
+    }
+
+    /*
+     * finish the current entry
+     */
+    int finishEntry()
+    {
+        return (zip != NULL) ? zip->finishFile() : 0;
+    }
+
+    /*
+     * Is a DataObj worth compressing? Not if its name shows that it is
+     * compressed already, or if its first block looks random.
+     */
+    static bool compressible(const char* name, const char* buf, size_t len)
+    {
+        static const char* compressed[] = {
+            ".gz", ".tgz", ".bz2", ".xz", ".zst", ".lz4", ".zip", ".7z", ".rar", ".jar", ".jpg", ".jpeg", ".png",
+            ".gif", ".webp", ".jp2", ".heic", ".mp3", ".mp4", ".m4a", ".mkv", ".mov", ".avi", ".webm", ".ogg",
+            ".flac", ".bam", ".cram", ".docx", ".xlsx", ".pptx", ".odt"};
+        size_t count[256];
+        size_t i, nameLen, extLen;
+        double entropy, p;
+
+        nameLen = strlen(name);
+        for (i = 0; i < sizeof(compressed) / sizeof(compressed[0]); i++) {
+            extLen = strlen(compressed[i]);
+            if (nameLen > extLen && strcasecmp(name + nameLen - extLen, compressed[i]) == 0) {
+                return false;
+            }
+        }
+
+        /*
+         * Shannon entropy of the bytes in the first 64 KiB, in bits per
+         * byte; deflate gains little above 7.5
+         */
+        len = std::min(len, (size_t) 65536);
+        if (len < A_TARBLOCK) {
+            return true;
+        }
+        memset(count, '\0', sizeof(count));
+        for (i = 0; i < len; i++) {
+            count[(unsigned char) buf[i]]++;
+        }
+        entropy = 0;
+        for (i = 0; i < 256; i++) {
+            if (count[i] != 0) {
+                p = (double) count[i] / (double) len;
+                entropy -= p * log2(p);
+            }
+        }
+        return (entropy < 7.5);
+    }
+
+    /*
+     * is the archive a zip file, rather than tar?
+     */
+    static bool isZip(const std::string& path)
+    {
+        return (path.length() >= 4 && path.compare(path.length() - 4, 4, ".zip") == 0);
+    }
+
+    /*
+     * parse an index, either JSON text or binary
+     */
+    static json_t* parseIndex(const std::string& index)
+    {
+        json_error_t error;
+
+        if (Cbor::isCbor(index)) {
+            return Cbor::decode(index);
+        }
+        return json_loads(index.c_str(), 0, &error);
+    }
+
+    /*
+     * construct an archive from a loaded index
+     */
+    static Archive* load(struct archive* a,
+                         Data* data,
+                         std::string& path,
+                         const char* resc,
+                         json_t* json,
+                         std::string indexString)
+    {
+        std::string origin;
+        json_t* list;
+        size_t size;
+        Archive* archive;
+
+        /*
+         * obtain list of items from INDEX.json
+         */
+        origin = json_string_value(json_object_get(json, "collection"));
+        size = (size_t) json_integer_value(json_object_get(json, "size"));
+        list = json_object_get(json, "items");
+        json_incref(list);
+
+        /*
+         * safe to call the constructor
+         */
+        archive = new Archive(a, data, false, list, size, path, origin, resc, indexString);
+
+        /*
+         * version 2 has tables of attribute sets and ACLs that items refer
+         * to, version 1 has neither a version nor tables
+         */
+        if (json_integer_value(json_object_get(json, "version")) >= 2) {
+            archive->version = (int) json_integer_value(json_object_get(json, "version"));
+            archive->attributeSets = json_incref(json_object_get(json, "attributeSets"));
+            archive->aclSets = json_incref(json_object_get(json, "ACLSets"));
+            archive->origins = json_incref(json_object_get(json, "origins"));
+        }
+        else {
+            archive->version = 1;
+        }
+        json_decref(json);
+        return archive;
+    }
+
+    /*
+     * update the attributes and ACL of an item already in the index, taking
+     * over the references
+     */
+    void update(json_t* json, json_t* attributes, json_t* acl)
+    {
+        int32_t set;
+
+        set = table.internAttributes(attributes);
+        if (set >= 0) {
+            json_object_set_new(json, "attributes", json_integer(set));
+        }
+        else {
+            json_object_del(json, "attributes");
+        }
+        set = table.internACL(acl);
+        if (set >= 0) {
+            json_object_set_new(json, "ACL", json_integer(set));
+        }
+        else {
+            json_object_del(json, "ACL");
+        }
+    }
+
+    /*
+     * Resolve a reference to a set of attributes or ACL in a version 2
+     * index. Version 1 indexes include the sets themselves.
+     */
+    static json_t* resolve(json_t* ref, json_t* sets)
+    {
+        return json_is_integer(ref) ? json_array_get(sets, (size_t) json_integer_value(ref)) : ref;
+    }
+
+    /*
+     * Serialize the index, with an optional stamp of the archive itself.
+     * Items are converted to JSON one at a time, so that the complete index
+     * never exists as a single JSON tree.
+     */
+    std::string dumpIndex(size_t flags, json_t* stamp, bool binary)
+    {
+        json_t *json, *value;
+        const char* key;
+        char* str;
+        std::string index, tail, indent, item;
+        size_t i, n, pos, width;
+
+        json = json_object();
+        if (version >= 2) {
+            json_object_set_new(json, "version", json_integer(version));
+        }
+        json_object_set_new(json, "collection", json_string(origin.c_str()));
+        json_object_set_new(json, "size", json_integer((json_int_t) dataSize));
+        if (stamp != NULL) {
+            json_object_set(json, "archive", stamp);
+        }
+        if (version >= 2) {
+            json_object_set(json, "attributeSets", table.attributeList());
+            json_object_set(json, "ACLSets", table.aclList());
+            value = table.originList();
+            if (value != NULL) {
+                json_object_set_new(json, "origins", value);
+            }
+        }
+        n = json_array_size(list) + table.size();
+
+        if (binary) {
+            /*
+             * the same object in CBOR, with the items last
+             */
+            Cbor::magic(index);
+            Cbor::head(index, Cbor::MAP, json_object_size(json) + 1);
+            json_object_foreach(json, key, value)
+            {
+                Cbor::text(index, key, strlen(key));
+                Cbor::encode(index, value);
+            }
+            json_decref(json);
+            Cbor::text(index, "items", 5);
+            Cbor::head(index, Cbor::ARRAY, n);
+            for (i = 0; i < n; i++) {
+                json = indexItem(i);
+                Cbor::encode(index, json);
+                json_decref(json);
+            }
+            return index;
+        }
+
+        json_object_set_new(json, "items", json_array());
+        str = json_dumps(json, flags);
+        json_decref(json);
+        index = str;
+        free(str);
+
+        /*
+         * fill in the empty list of items at the end
+         */
+        pos = index.rfind("[]");
+        tail = index.substr(pos + 1);
+        index.resize(pos + 1);
+        width = flags & JSON_MAX_INDENT;
+        indent = (width != 0) ? "\n" + std::string(2 * width, ' ') : "";
+        for (i = 0; i < n; i++) {
+            json = indexItem(i);
+            str = json_dumps(json, flags);
+            json_decref(json);
+            item = str;
+            free(str);
+
+            for (pos = item.find('\n'); pos != std::string::npos; pos = item.find('\n', pos + indent.length())) {
+                item.replace(pos, 1, indent);
+            }
+            index += ((i != 0) ? (width != 0 ? "," : ", ") : "") + indent + item;
+        }
+        if (width != 0 && i != 0) {
+            index += "\n" + std::string(width, ' ');
+        }
+        return index + tail;
+    }
+
+    /*
+     * an item of the index as it is written, existing items first
+     */
+    json_t* indexItem(size_t i)
+    {
+        json_t *json, *copy, *value;
+
+        if (i < json_array_size(list)) {
+            json = json_incref(json_array_get(list, i));
+        }
+        else {
+            json = table.json(i - json_array_size(list));
+        }
+        if (version < 2) {
+            /*
+             * version 1: include the sets with every item
+             */
+            copy = json_copy(json);
+            json_decref(json);
+            json = copy;
+            if (json_object_get(json, "attributes") != NULL) {
+                json_object_set(json,
+                                "attributes",
+                                resolve(json_object_get(json, "attributes"), table.attributeList()));
+            }
+            if (json_object_get(json, "ACL") != NULL) {
+                json_object_set(json, "ACL", resolve(json_object_get(json, "ACL"), table.aclList()));
+            }
+            value = json_object_get(json, "origin");
+            if (json_is_integer(value)) {
+                value = json_string(table.originName((size_t) json_integer_value(value)).c_str());
+                json_object_set_new(json, "origin", value);
+            }
+        }
+        return json;
+    }
+
+    /*
+     * Is a tar block the ustar header of a regular file with the given name
+     * and size? Names and sizes that do not fit in a ustar header are
+     * stored in a pax header instead, and never match.
+     */
+    static bool isHeader(const char* header, const char* name, rodsLong_t size)
+    {
+        std::string filename;
+
+        if (name == NULL || strncmp(&header[257], "ustar", 5) != 0 || (header[156] != '0' && header[156] != '\0')) {
+            return false;
+        }
+
+        /*
+         * prefix (155 bytes at 345) and name (100 bytes at 0), neither
+         * necessarily terminated
+         */
+        if (header[345] != '\0') {
+            filename.assign(&header[345], strnlen(&header[345], 155));
+            filename += '/';
+        }
+        filename.append(header, strnlen(header, 100));
+        if (filename != name) {
+            return false;
+        }
+
+        /*
+         * size (12 bytes at 124)
+         */
+        return (_tarNumber(&header[124], 12) == size);
+    }
+
+    /*
+     * obtain catalog information on a DataObj, or NULL if it does not exist
+     */
+    static rodsObjStat_t* _stat(rsComm_t* rsComm, const char* name)
+    {
+        dataObjInp_t dataObjInp;
+        rodsObjStat_t* objStat;
+
+        memset(&dataObjInp, '\0', sizeof(dataObjInp_t));
+        rstrcpy(dataObjInp.objPath, name, MAX_NAME_LEN);
+        objStat = NULL;
+        if (rsObjStat(rsComm, &dataObjInp, &objStat) < 0 || objStat == NULL) {
+            if (objStat != NULL) {
+                freeRodsObjStat(objStat);
+            }
+            return NULL;
+        }
+        return objStat;
+    }
+
+    /*
+     * may the client user read a DataObj, directly or through a group?
+     */
+    static bool _readable(rsComm_t* rsComm, rodsObjStat_t* objStat)
+    {
+        char tmpStr[MAX_NAME_LEN];
+        genQueryInp_t genQueryInp;
+        genQueryOut_t* genQueryOut;
+        sqlResult_t *users, *access;
+        std::set<std::string> ids;
+        const char* name;
+        bool readable;
+
+        /*
+         * the IDs of the user and of all groups that the user is in
+         */
+        memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
+        snprintf(tmpStr, MAX_NAME_LEN, "='%s'", rsComm->clientUser.userName);
+        addInxVal(&genQueryInp.sqlCondInp, COL_USER_NAME, tmpStr);
+        snprintf(tmpStr, MAX_NAME_LEN, "='%s'", rsComm->clientUser.rodsZone);
+        addInxVal(&genQueryInp.sqlCondInp, COL_USER_ZONE, tmpStr);
+        addInxIval(&genQueryInp.selectInp, COL_USER_ID, 1);
+        addInxIval(&genQueryInp.selectInp, COL_USER_GROUP_ID, 1);
+        genQueryInp.maxRows = MAX_SQL_ROWS;
+        genQueryOut = NULL;
+        while (rsGenQuery(rsComm, &genQueryInp, &genQueryOut) == 0 && genQueryOut->rowCnt != 0) {
+            users = getSqlResultByInx(genQueryOut, COL_USER_ID);
+            access = getSqlResultByInx(genQueryOut, COL_USER_GROUP_ID);
+            for (int i = 0; i < genQueryOut->rowCnt; i++) {
+                ids.insert(&users->value[users->len * i]);
+                ids.insert(&access->value[access->len * i]);
+            }
+
+            genQueryInp.continueInx = genQueryOut->continueInx;
+            if (genQueryInp.continueInx == 0) {
+                break;
+            }
+            freeGenQueryOut(&genQueryOut);
+        }
+        clearGenQueryInp(&genQueryInp);
+        freeGenQueryOut(&genQueryOut);
+
+        /*
+         * any access level that includes reading the object, with the
+         * names of iRODS 4.3 and of older versions
+         */
+        static const std::set<std::string> levels = {
+            "read_object",     "read object",     "create_metadata", "create metadata", "modify_metadata",
+            "modify metadata", "delete_metadata", "delete metadata", "create_object",   "create object",
+            "modify_object",   "modify object",   "delete_object",   "delete object",   "own"
+        };
+        memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
+        snprintf(tmpStr, MAX_NAME_LEN, "='%s'", objStat->dataId);
+        addInxVal(&genQueryInp.sqlCondInp, COL_DATA_ACCESS_DATA_ID, tmpStr);
+        addInxVal(&genQueryInp.sqlCondInp, COL_DATA_TOKEN_NAMESPACE, "='access_type'");
+        addInxIval(&genQueryInp.selectInp, COL_DATA_ACCESS_USER_ID, 1);
+        addInxIval(&genQueryInp.selectInp, COL_DATA_ACCESS_NAME, 1);
+        genQueryInp.maxRows = MAX_SQL_ROWS;
+        genQueryOut = NULL;
+        readable = false;
+        while (!readable && rsGenQuery(rsComm, &genQueryInp, &genQueryOut) == 0 && genQueryOut->rowCnt != 0) {
+            users = getSqlResultByInx(genQueryOut, COL_DATA_ACCESS_USER_ID);
+            access = getSqlResultByInx(genQueryOut, COL_DATA_ACCESS_NAME);
+            for (int i = 0; i < genQueryOut->rowCnt; i++) {
+                name = &access->value[access->len * i];
+                if (ids.count(&users->value[users->len * i]) != 0 && levels.count(name) != 0) {
+                    readable = true;
+                    break;
+                }
+            }
+
+            genQueryInp.continueInx = genQueryOut->continueInx;
+            if (genQueryInp.continueInx == 0) {
+                break;
+            }
+            freeGenQueryOut(&genQueryOut);
+        }
+        if (readable && genQueryInp.continueInx != 0) {
+            /*
+             * close the query that was not read to the end
+             */
+            genQueryInp.maxRows = 0;
+            freeGenQueryOut(&genQueryOut);
+            rsGenQuery(rsComm, &genQueryInp, &genQueryOut);
+        }
+        clearGenQueryInp(&genQueryInp);
+        freeGenQueryOut(&genQueryOut);
+
+        return readable;
+    }
+
+    /*
+     * create an iRODS DataObj
+     */
+    static int _creat(Data* data, const char* name)
+    {
+        int fd;
+
+        /*
+         * workaround for https://github.com/irods/irods/issues/4692:
+         * don't use forceFlag with create
+         */
+        memset(&data->create, '\0', sizeof(dataObjInp_t));
+        data->create.openFlags = O_WRONLY | O_TRUNC;
+        if (data->resource != NULL) {
+            addKeyVal(&data->create.condInput, DEST_RESC_NAME_KW, data->resource);
+        }
+        addKeyVal(&data->create.condInput, TRANSLATED_PATH_KW, "");
+        rstrcpy(data->create.objPath, name, MAX_NAME_LEN);
+        fd = rsDataObjOpen(data->rsComm, &data->create);
 
         if (fd == OBJ_PATH_DOES_NOT_EXIST) {
             memset(&data->create, '\0', sizeof(dataObjInp_t));
@@ -474,14 +1777,23 @@ class Archive
     }
 
     /*
-     * open an iRODS DataObj
+     * Open an iRODS DataObj, optionally the replica on a given resource
+     * hierarchy. The full hierarchy is needed to select a replica, since
+     * replicas may share a root resource.
      */
-    static int _open(Data* data, const char* name)
+    static int _open(Data* data, const char* name, int flags = O_RDONLY, const char* hier = NULL)
     {
+        int fd;
+
         memset(&data->open, '\0', sizeof(dataObjInp_t));
-        data->open.openFlags = O_RDONLY;
+        data->open.openFlags = flags;
+        if (hier != NULL) {
+            addKeyVal(&data->open.condInput, RESC_HIER_STR_KW, hier);
+        }
         rstrcpy(data->open.objPath, name, MAX_NAME_LEN);
-        return rsDataObjOpen(data->rsComm, &data->open);
+        fd = rsDataObjOpen(data->rsComm, &data->open);
+        clearKeyVal(&data->open.condInput);
+        return fd;
     }
 
     /*
@@ -516,6 +1828,123 @@ class Archive
         return rsDataObjWrite(rsComm, &input, &wbuf);
     }
 
+    /*
+     * set the offset in an iRODS DataObj, return the new offset
+     */
+    static rodsLong_t _seek(rsComm_t* rsComm, int index, rodsLong_t offset)
+    {
+        openedDataObjInp_t input;
+        fileLseekOut_t* output;
+        rodsLong_t status;
+
+        memset(&input, '\0', sizeof(openedDataObjInp_t));
+        input.l1descInx = index;
+        input.offset = offset;
+        input.whence = SEEK_SET;
+        output = NULL;
+        status = rsDataObjLseek(rsComm, &input, &output);
+        if (output != NULL) {
+            if (status >= 0) {
+                status = output->offset;
+            }
+            free(output);
+        }
+        return status;
+    }
+
+    /*
+     * parse a numeric field of a tar header, octal or base-256
+     */
+    static rodsLong_t _tarNumber(const char* field, size_t len)
+    {
+        rodsLong_t value;
+        size_t i;
+
+        value = 0;
+        if (field[0] & 0x80) {
+            for (i = 1; i < len; i++) {
+                value = (value << 8) | (unsigned char) field[i];
+            }
+        }
+        else {
+            for (i = 0; i < len && field[i] == ' '; i++) {
+            }
+            for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+                value = (value << 3) | (field[i] - '0');
+            }
+        }
+        return value;
+    }
+
+    /*
+     * Walk the headers of an uncompressed tar archive to find the data of
+     * the index and the end of the last member.
+     */
+    static int _tarScan(rsComm_t* rsComm, int index, rodsLong_t* indexOffset, size_t* indexSize, rodsLong_t* end)
+    {
+        char header[A_TARBLOCK];
+        rodsLong_t offset, size, paxSize;
+        std::string pax;
+        const char* str;
+        size_t i;
+
+        *indexOffset = -1;
+        paxSize = -1;
+        for (offset = 0;; offset += A_TARBLOCK + ((size + A_TARBLOCK - 1) & ~(rodsLong_t) (A_TARBLOCK - 1))) {
+            if (_seek(rsComm, index, offset) != offset || _read(rsComm, index, header, A_TARBLOCK) != A_TARBLOCK) {
+                return SYS_TAR_OPEN_ERR;
+            }
+            for (i = 0; i < A_TARBLOCK && header[i] == '\0'; i++) {
+            }
+            if (i == A_TARBLOCK) {
+                /*
+                 * end of archive
+                 */
+                *end = offset;
+                return (*indexOffset >= 0) ? 0 : SYS_TAR_OPEN_ERR;
+            }
+            if (strncmp(&header[257], "ustar", 5) != 0) {
+                return SYS_TAR_OPEN_ERR;
+            }
+
+            size = _tarNumber(&header[124], 12);
+            if (header[156] == 'x') {
+                /*
+                 * pax extended header, may override the size of the next
+                 * member
+                 */
+                pax.resize((size_t) size);
+                if (_read(rsComm, index, &pax[0], (size_t) size) != size) {
+                    return SYS_TAR_OPEN_ERR;
+                }
+                for (str = pax.c_str(); str != NULL; str = strchr(str, '\n')) {
+                    if (*str == '\n') {
+                        str++;
+                    }
+                    const char* key = strchr(str, ' ');
+                    if (key != NULL && strncmp(key + 1, "size=", 5) == 0) {
+                        paxSize = strtoll(key + 6, NULL, 10);
+                    }
+                }
+                continue;
+            }
+            if (header[156] == 'g') {
+                continue;
+            }
+
+            if (paxSize >= 0) {
+                size = paxSize;
+                paxSize = -1;
+            }
+            if (*indexOffset < 0 && header[345] == '\0' &&
+                (strncmp(header, A_INDEX, 100) == 0 || strncmp(header, A_INDEXCBOR, 100) == 0))
+            {
+                *indexOffset = offset + A_TARBLOCK;
+                *indexSize = (size_t) size;
+            }
+        }
+    }
+
     /*
      * close an iRODS DatObj
      */
@@ -587,6 +2016,14 @@ class Archive
         }
     }
 
+    /*
+     * libarchive close callback that keeps the DataObj open
+     */
+    static int a_keep(struct archive* a, void* data)
+    {
+        return 0;
+    }
+
     /*
      * libarchive wrapper for _close()
      */
@@ -608,4 +2045,19 @@ class Archive
     std::string path; /* path of archive */
     std::string origin; /* original collection */
     std::string indexString; /* index as a string */
+    ItemTable table; /* items to add to a new archive */
+    int version; /* index format version */
+    bool cbor; /* binary index? */
+    int order; /* order in which new DataObjs are written */
+    int compression; /* compression of DataObjs in a zip archive */
+    size_t threads; /* compression threads for a zip archive */
+    ZipWriter* zip; /* writer for a new zip archive */
+    std::function<int(size_t, size_t, size_t, size_t)> progress; /* progress callback */
+    json_t* attributeSets; /* attribute sets of a version 2 index */
+    json_t* aclSets; /* ACLs of a version 2 index */
+    json_t* origins; /* origins of a multi-source version 2 index */
+    size_t reserve; /* space reserved for INDEX.json */
+    rodsLong_t indexOffset; /* offset of INDEX.json when appending, or -1 */
+    rodsLong_t base; /* offset at which writing starts */
+    std::map<std::string, json_t*> existing; /* items already in the archive when appending */
 };
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <jansson.h>
+
+#include "rsGenQuery.hpp"
+#include "rsModAVUMetadata.hpp"
+#include "Archive.hh"
+
+#include <time.h>
+#include <random>
+#include <string>
+
+#define A_JOBCANCEL   "org_archive_job_cancel"
+#define A_JOBINTERVAL 10 /* seconds between status updates */
+#define A_JOBTIMEOUT  3600 /* seconds without a status update after which a job is considered dead */
+#define A_JOBDELAY    "<INST_NAME>irods_rule_engine_plugin-irods_rule_language-instance</INST_NAME><PLUSET>1s</PLUSET>"
+#define A_JOBCANCELED SYS_UNMATCHED_API_NUM /* returned by a canceled worker, recorded as "canceled" */
+
+/*
+ * Archive operation running in the background. The microservice that starts
+ * a job submits a delayed rule that calls it again, as the worker. The state
+ * and progress of the job are kept as JSON in a status DataObj next to the
+ * archive, which also identifies the job. A job is canceled by setting an
+ * attribute on the status DataObj, which the worker checks whenever it
+ * updates the status.
+ *
+ * Every job has a random ID, which only its own delayed rule passes to the
+ * worker. A job that is queued or running but has not updated its status
+ * for A_JOBTIMEOUT seconds is considered dead: it no longer blocks new jobs
+ * on the archive, and canceling it takes effect at once.
+ */
+class ArchiveJob
+{
+  public:
+    ArchiveJob(rsComm_t* rsComm, std::string archive, const char* operation)
+        : rsComm(rsComm)
+        , archive(archive)
+        , operation(operation)
+        , state("queued")
+        , worker(false)
+        , cancelSeen(false)
+        , started(0)
+        , updated(0)
+        , items(0)
+        , totalItems(0)
+        , bytes(0)
+        , totalBytes(0)
+    {
+    }
+
+    /*
+     * path of the status DataObj of a job on an archive
+     */
+    static std::string statusPath(const std::string& archive)
+    {
+        return archive + A_JOBSUFFIX;
+    }
+
+    /*
+     * quote a string for the rule language
+     */
+    static std::string quote(const std::string& str)
+    {
+        std::string quoted;
+
+        quoted = "\"";
+        for (size_t i = 0; i < str.length(); i++) {
+            if (strchr("\\\"*$", str[i]) != NULL) {
+                quoted += '\\';
+            }
+            quoted += str[i];
+        }
+        return quoted + "\"";
+    }
+
+    /*
+     * Submit a job, given the call of the microservice with its options in
+     * *options and its status in *status. Options are passed as a string of
+     * key-value pairs, separated by "++++".
+     */
+    int submit(ruleExecInfo_t* rei, const std::string& call, const std::string& options)
+    {
+        modAVUMetadataInp_t modAVUInp;
+        json_t* json;
+        const char* current;
+        std::string path;
+        int result;
+
+        json = status(rsComm, archive);
+        if (json != NULL) {
+            current = json_string_value(json_object_get(json, "state"));
+            if (active(json)) {
+                rodsLog(LOG_ERROR, "msiArchiveJob: a job on %s is already %s", archive.c_str(), current);
+                json_decref(json);
+                return SYS_INVALID_INPUT_PARAM;
+            }
+            json_decref(json);
+        }
+
+        id = newID();
+        result = write(0);
+        if (result < 0) {
+            return result;
+        }
+
+        /*
+         * a cancellation of an earlier job does not apply to this one
+         */
+        path = statusPath(archive);
+        memset(&modAVUInp, '\0', sizeof(modAVUMetadataInp_t));
+        modAVUInp.arg0 = (char*) "rmw";
+        modAVUInp.arg1 = (char*) "-d";
+        modAVUInp.arg2 = (char*) path.c_str();
+        modAVUInp.arg3 = (char*) A_JOBCANCEL;
+        modAVUInp.arg4 = (char*) "%";
+        rsModAVUMetadata(rsComm, &modAVUInp); /* allowed to fail */
+
+        std::string rule =
+            "msiString2KeyValPair(" + quote(options + (options.empty() ? "" : "++++") + "jobWorker=" + id) +
+            ", *options); " + call;
+        result = _delayExec(rule.c_str(), "", A_JOBDELAY, rei);
+        if (result < 0) {
+            state = "failed";
+            write(result);
+        }
+        return result;
+    }
+
+    /*
+     * The worker of the job with the given ID starts. Return
+     * A_JOBCANCELED if the job was canceled while it was queued, or an
+     * error if there is no such job waiting for a worker; the status is
+     * then left alone.
+     */
+    int start(const char* id)
+    {
+        json_t* json;
+        const char* current;
+
+        json = status(rsComm, archive);
+        current = (json != NULL) ? json_string_value(json_object_get(json, "state")) : NULL;
+        if (current == NULL || strcmp(current, "queued") != 0 ||
+            json_string_value(json_object_get(json, "id")) == NULL ||
+            strcmp(json_string_value(json_object_get(json, "id")), id) != 0)
+        {
+            rodsLog(LOG_ERROR, "msiArchiveJob: no queued job %s on %s", id, archive.c_str());
+            if (json != NULL) {
+                json_decref(json);
+            }
+            return SYS_INVALID_INPUT_PARAM;
+        }
+        json_decref(json);
+
+        this->id = id;
+        worker = true;
+        started = time(NULL);
+        if (canceled()) {
+            cancelSeen = true;
+            return A_JOBCANCELED;
+        }
+        state = "running";
+        return write(0);
+    }
+
+    /*
+     * Report progress. The status DataObj is updated at most once every
+     * A_JOBINTERVAL seconds; return A_JOBCANCELED if the job was canceled.
+     */
+    int progress(size_t items, size_t totalItems, size_t bytes, size_t totalBytes)
+    {
+        this->items = items;
+        this->totalItems = totalItems;
+        this->bytes = bytes;
+        this->totalBytes = totalBytes;
+        if (time(NULL) - updated < A_JOBINTERVAL) {
+            return 0;
+        }
+        if (canceled()) {
+            cancelSeen = true;
+            return A_JOBCANCELED;
+        }
+        write(0); /* allowed to fail */
+        return 0;
+    }
+
+    /*
+     * the worker is done, if it was started
+     */
+    void finish(int status)
+    {
+        if (!worker) {
+            return;
+        }
+        state = cancelSeen ? "canceled" : (status == 0) ? "done" : "failed";
+        write(cancelSeen ? 0 : status);
+    }
+
+    /*
+     * obtain the status of the job on an archive, or NULL if there is none
+     */
+    static json_t* status(rsComm_t* rsComm, const std::string& archive)
+    {
+        std::string str;
+
+        if (Archive::readObject(rsComm, statusPath(archive).c_str(), str) < 0) {
+            return NULL;
+        }
+        return json_loads(str.c_str(), 0, NULL);
+    }
+
+    /*
+     * Is a job with the given status queued or running, with a status
+     * update less than A_JOBTIMEOUT seconds ago?
+     */
+    static bool active(json_t* json)
+    {
+        const char* current;
+
+        current = json_string_value(json_object_get(json, "state"));
+        return (current != NULL && (strcmp(current, "queued") == 0 || strcmp(current, "running") == 0) &&
+                time(NULL) - (time_t) json_integer_value(json_object_get(json, "updated")) < A_JOBTIMEOUT);
+    }
+
+    /*
+     * Cancel the job on an archive. A running worker stops at its next
+     * status update. A job that is still queued, or that is considered
+     * dead, is marked as canceled at once, since there may be no worker
+     * left to do so.
+     */
+    static int cancel(rsComm_t* rsComm, const std::string& archive)
+    {
+        modAVUMetadataInp_t modAVUInp;
+        json_t* json;
+        const char* current;
+        std::string path;
+        char* str;
+        int result;
+
+        path = statusPath(archive);
+        memset(&modAVUInp, '\0', sizeof(modAVUMetadataInp_t));
+        modAVUInp.arg0 = (char*) "set";
+        modAVUInp.arg1 = (char*) "-d";
+        modAVUInp.arg2 = (char*) path.c_str();
+        modAVUInp.arg3 = (char*) A_JOBCANCEL;
+        modAVUInp.arg4 = (char*) "1";
+        modAVUInp.arg5 = (char*) "";
+        result = rsModAVUMetadata(rsComm, &modAVUInp);
+        if (result < 0) {
+            return result;
+        }
+
+        json = status(rsComm, archive);
+        if (json == NULL) {
+            return 0;
+        }
+        current = json_string_value(json_object_get(json, "state"));
+        if (current != NULL &&
+            (strcmp(current, "queued") == 0 || (strcmp(current, "running") == 0 && !active(json))))
+        {
+            json_object_set_new(json, "state", json_string("canceled"));
+            json_object_set_new(json, "updated", json_integer((json_int_t) time(NULL)));
+            json_object_del(json, "eta");
+            str = json_dumps(json, JSON_INDENT(2));
+            result = Archive::writeObject(rsComm, path.c_str(), NULL, str, strlen(str));
+            free(str);
+        }
+        json_decref(json);
+        return result;
+    }
+
+  private:
+    /*
+     * new random job ID
+     */
+    static std::string newID()
+    {
+        std::random_device random;
+        char str[17];
+
+        snprintf(str, sizeof(str), "%08x%08x", (unsigned int) random(), (unsigned int) random());
+        return str;
+    }
+
+    /*
+     * has the job been canceled?
+     */
+    bool canceled()
+    {
+        char condStr[MAX_NAME_LEN];
+        genQueryInp_t genQueryInp;
+        genQueryOut_t* genQueryOut;
+        std::string path;
+        size_t pos;
+        bool canceled;
+
+        path = statusPath(archive);
+        pos = path.rfind('/');
+        memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
+        snprintf(condStr, MAX_NAME_LEN, "='%s'", path.substr(0, pos).c_str());
+        addInxVal(&genQueryInp.sqlCondInp, COL_COLL_NAME, condStr);
+        snprintf(condStr, MAX_NAME_LEN, "='%s'", path.substr(pos + 1).c_str());
+        addInxVal(&genQueryInp.sqlCondInp, COL_DATA_NAME, condStr);
+        addInxVal(&genQueryInp.sqlCondInp, COL_META_DATA_ATTR_NAME, "='" A_JOBCANCEL "'");
+        addInxIval(&genQueryInp.selectInp, COL_D_DATA_ID, 1);
+        genQueryInp.maxRows = 1;
+        genQueryOut = NULL;
+        canceled = (rsGenQuery(rsComm, &genQueryInp, &genQueryOut) == 0 && genQueryOut->rowCnt != 0);
+        clearGenQueryInp(&genQueryInp);
+        freeGenQueryOut(&genQueryOut);
+
+        return canceled;
+    }
+
+    /*
+     * write the status DataObj
+     */
+    int write(int status)
+    {
+        json_t* json;
+        char* str;
+        double eta;
+        int result;
+
+        updated = time(NULL);
+        json = json_object();
+        json_object_set_new(json, "archive", json_string(archive.c_str()));
+        json_object_set_new(json, "id", json_string(id.c_str()));
+        json_object_set_new(json, "operation", json_string(operation));
+        json_object_set_new(json, "state", json_string(state));
+        json_object_set_new(json, "updated", json_integer((json_int_t) updated));
+        if (started != 0) {
+            json_object_set_new(json, "started", json_integer((json_int_t) started));
+            json_object_set_new(json, "items", json_integer((json_int_t) items));
+            json_object_set_new(json, "totalItems", json_integer((json_int_t) totalItems));
+            json_object_set_new(json, "bytes", json_integer((json_int_t) bytes));
+            json_object_set_new(json, "totalBytes", json_integer((json_int_t) totalBytes));
+            if (strcmp(state, "running") == 0 && bytes != 0) {
+                /*
+                 * estimated seconds left, at the average rate so far
+                 */
+                eta = (double) (updated - started) * (double) (totalBytes - bytes) / (double) bytes;
+                json_object_set_new(json, "eta", json_integer((json_int_t) eta));
+            }
+        }
+        if (status != 0) {
+            json_object_set_new(json, "status", json_integer(status));
+        }
+        str = json_dumps(json, JSON_INDENT(2));
+        json_decref(json);
+        result = Archive::writeObject(rsComm, statusPath(archive).c_str(), NULL, str, strlen(str));
+        free(str);
+        return result;
+    }
+
+    rsComm_t* rsComm; /* iRODS context */
+    std::string archive; /* path of the archive */
+    const char* operation; /* "create" or "extract" */
+    std::string id; /* random ID of the job */
+    const char* state; /* "queued", "running", "done", "failed" or "canceled" */
+    bool worker; /* is this the started worker of the job? */
+    bool cancelSeen; /* has the worker seen that the job was canceled? */
+    time_t started; /* start of the worker, or 0 */
+    time_t updated; /* last update of the status DataObj */
+    size_t items; /* items done */
+    size_t totalItems; /* items to do */
+    size_t bytes; /* bytes of DataObjs done */
+    size_t totalBytes; /* bytes of DataObjs to do */
+};
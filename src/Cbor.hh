@@ -0,0 +1,320 @@
+#pragma once
+
+#include <jansson.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#define A_CBORMAGIC "\xd9\xd9\xf7" /* self-describe tag 55799 */
+#define A_CBORDEPTH 64
+
+/*
+ * Binary encoding of JSON values in CBOR (RFC 8949), for indexes that must
+ * load faster than JSON text can be parsed. Encoded values start with the
+ * self-describe tag, so that they can be told apart from JSON text. Data
+ * after the first value is ignored, which allows an encoded index to be
+ * padded.
+ */
+class Cbor
+{
+  public:
+    /*
+     * major types
+     */
+    enum
+    {
+        UNSIGNED = 0,
+        NEGATIVE = 1,
+        BYTES = 2,
+        TEXT = 3,
+        ARRAY = 4,
+        MAP = 5,
+        TAG = 6,
+        SIMPLE = 7
+    };
+
+    /*
+     * does a string hold a CBOR encoded value?
+     */
+    static bool isCbor(const std::string& str)
+    {
+        return (str.compare(0, 3, A_CBORMAGIC) == 0);
+    }
+
+    /*
+     * append the self-describe tag
+     */
+    static void magic(std::string& out)
+    {
+        out.append(A_CBORMAGIC);
+    }
+
+    /*
+     * append the head of a data item
+     */
+    static void head(std::string& out, int major, uint64_t value)
+    {
+        char buf[9];
+        int len, i;
+
+        if (value < 24) {
+            buf[0] = (char) ((major << 5) | (int) value);
+            len = 0;
+        }
+        else if (value <= 0xff) {
+            buf[0] = (char) ((major << 5) | 24);
+            len = 1;
+        }
+        else if (value <= 0xffff) {
+            buf[0] = (char) ((major << 5) | 25);
+            len = 2;
+        }
+        else if (value <= 0xffffffff) {
+            buf[0] = (char) ((major << 5) | 26);
+            len = 4;
+        }
+        else {
+            buf[0] = (char) ((major << 5) | 27);
+            len = 8;
+        }
+        for (i = len; i > 0; i--) {
+            buf[i] = (char) (value & 0xff);
+            value >>= 8;
+        }
+        out.append(buf, (size_t) len + 1);
+    }
+
+    /*
+     * append a text string
+     */
+    static void text(std::string& out, const char* str, size_t len)
+    {
+        head(out, TEXT, len);
+        out.append(str, len);
+    }
+
+    /*
+     * append a JSON value
+     */
+    static void encode(std::string& out, json_t* json)
+    {
+        const char* key;
+        json_t* value;
+        json_int_t i;
+        double d;
+        uint64_t bits;
+        size_t n;
+
+        switch (json_typeof(json)) {
+            case JSON_OBJECT:
+                head(out, MAP, json_object_size(json));
+                json_object_foreach(json, key, value)
+                {
+                    text(out, key, strlen(key));
+                    encode(out, value);
+                }
+                break;
+
+            case JSON_ARRAY:
+                head(out, ARRAY, json_array_size(json));
+                for (n = 0; n < json_array_size(json); n++) {
+                    encode(out, json_array_get(json, n));
+                }
+                break;
+
+            case JSON_STRING:
+                text(out, json_string_value(json), json_string_length(json));
+                break;
+
+            case JSON_INTEGER:
+                i = json_integer_value(json);
+                if (i >= 0) {
+                    head(out, UNSIGNED, (uint64_t) i);
+                }
+                else {
+                    head(out, NEGATIVE, (uint64_t) (-1 - i));
+                }
+                break;
+
+            case JSON_REAL:
+                /*
+                 * always a double
+                 */
+                d = json_real_value(json);
+                memcpy(&bits, &d, sizeof(bits));
+                out.push_back((char) ((SIMPLE << 5) | 27));
+                for (n = 8; n > 0; n--) {
+                    out.push_back((char) ((bits >> (8 * (n - 1))) & 0xff));
+                }
+                break;
+
+            case JSON_TRUE:
+                head(out, SIMPLE, 21);
+                break;
+
+            case JSON_FALSE:
+                head(out, SIMPLE, 20);
+                break;
+
+            default:
+                head(out, SIMPLE, 22);
+                break;
+        }
+    }
+
+    /*
+     * encode a JSON value, including the self-describe tag
+     */
+    static std::string encode(json_t* json)
+    {
+        std::string out;
+
+        magic(out);
+        encode(out, json);
+        return out;
+    }
+
+    /*
+     * decode a value into JSON, return NULL if it is not valid
+     */
+    static json_t* decode(const std::string& str)
+    {
+        const unsigned char* ptr;
+
+        ptr = (const unsigned char*) str.data();
+        return decode(&ptr, ptr + str.length(), 0);
+    }
+
+  private:
+    /*
+     * decode the head of a data item, return false if incomplete
+     */
+    static bool decodeHead(const unsigned char** ptr, const unsigned char* end, int* major, int* info, uint64_t* value)
+    {
+        const unsigned char* p;
+        int len;
+
+        p = *ptr;
+        if (p >= end) {
+            return false;
+        }
+        *major = *p >> 5;
+        *info = *p++ & 0x1f;
+        if (*info < 24) {
+            len = 0;
+            *value = (uint64_t) *info;
+        }
+        else if (*info <= 27) {
+            len = 1 << (*info - 24);
+            *value = 0;
+        }
+        else {
+            return false; /* indefinite lengths are not used */
+        }
+        if (end - p < len) {
+            return false;
+        }
+        while (len-- > 0) {
+            *value = (*value << 8) | *p++;
+        }
+        *ptr = p;
+        return true;
+    }
+
+    /*
+     * decode a value
+     */
+    static json_t* decode(const unsigned char** ptr, const unsigned char* end, int depth)
+    {
+        json_t *json, *value;
+        int major, info;
+        uint64_t n, i;
+        double d;
+        float f;
+        uint32_t bits;
+
+        if (depth > A_CBORDEPTH || !decodeHead(ptr, end, &major, &info, &n)) {
+            return NULL;
+        }
+
+        switch (major) {
+            case UNSIGNED:
+                return (n <= INT64_MAX) ? json_integer((json_int_t) n) : NULL;
+
+            case NEGATIVE:
+                return (n <= INT64_MAX) ? json_integer(-1 - (json_int_t) n) : NULL;
+
+            case BYTES:
+            case TEXT:
+                if ((uint64_t) (end - *ptr) < n) {
+                    return NULL;
+                }
+                json = json_stringn((const char*) *ptr, (size_t) n);
+                *ptr += n;
+                return json;
+
+            case ARRAY:
+                if ((uint64_t) (end - *ptr) < n) {
+                    return NULL; /* every element takes at least one byte */
+                }
+                json = json_array();
+                for (i = 0; i < n; i++) {
+                    value = decode(ptr, end, depth + 1);
+                    if (value == NULL) {
+                        json_decref(json);
+                        return NULL;
+                    }
+                    json_array_append_new(json, value);
+                }
+                return json;
+
+            case MAP:
+                if ((uint64_t) (end - *ptr) / 2 < n) {
+                    return NULL;
+                }
+                json = json_object();
+                for (i = 0; i < n; i++) {
+                    uint64_t len;
+
+                    if (!decodeHead(ptr, end, &major, &info, &len) || major != TEXT ||
+                        (uint64_t) (end - *ptr) < len)
+                    {
+                        json_decref(json);
+                        return NULL;
+                    }
+                    std::string key((const char*) *ptr, (size_t) len);
+                    *ptr += len;
+                    value = decode(ptr, end, depth + 1);
+                    if (value == NULL || json_object_set_new(json, key.c_str(), value) != 0) {
+                        json_decref(json);
+                        return NULL;
+                    }
+                }
+                return json;
+
+            case TAG:
+                return decode(ptr, end, depth + 1);
+
+            default:
+                switch (info) {
+                    case 20:
+                        return json_false();
+                    case 21:
+                        return json_true();
+                    case 22:
+                    case 23:
+                        return json_null();
+                    case 26:
+                        bits = (uint32_t) n;
+                        memcpy(&f, &bits, sizeof(f));
+                        return json_real((double) f);
+                    case 27:
+                        memcpy(&d, &n, sizeof(d));
+                        return json_real(d);
+                    default:
+                        return NULL; /* half precision is not used */
+                }
+        }
+    }
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <jansson.h>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define A_CACHEROOT     "/var/lib/irods/.checksum_cache"
+#define A_SUMCACHESIZE  ((off_t) 1024 * 1024 * 1024) /* per resource */
+#define A_SUMCACHEPRUNE 3600 /* seconds between prune passes over a subdirectory */
+
+/*
+ * Persistent cache of the checksums of local files, in a directory of its
+ * own per resource. Every file has an entry of its own, named after its
+ * device and inode, which holds the size, modification time and status
+ * change time of the file when it was hashed, and the checksum of every
+ * algorithm with the time it was last computed:
+ *
+ *   {"size": ..., ..., "checksums": {"sha256": {"sum": ..., "verified": ...}}}
+ *
+ * An entry only applies while the file still has the same size and times.
+ * Entries are replaced by renaming, so that agents can share the cache
+ * without locking. Entries are spread over 256 subdirectories; the least
+ * recently used entries of a subdirectory are evicted when it exceeds its
+ * share of the size limit.
+ */
+class ChecksumCache
+{
+  public:
+    ChecksumCache(const std::string& dir, off_t limit = A_SUMCACHESIZE)
+        : dir(dir)
+        , limit(limit)
+    {
+    }
+
+    /*
+     * do two statuses of a file describe the same contents?
+     */
+    static bool same(const struct stat& a, const struct stat& b)
+    {
+        return (a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+                a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+                a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec);
+    }
+
+    /*
+     * Look up the checksums of a file with the given status, one per
+     * algorithm, and when the least recently computed of them was
+     * computed. Return false unless there is a checksum for every
+     * algorithm.
+     */
+    bool lookup(const struct stat& st,
+                const std::vector<std::string>& algorithms,
+                std::vector<std::string>& checksums,
+                time_t& verified)
+    {
+        json_t* json;
+        json_t* sums;
+        json_t* entry;
+        const char* sum;
+        bool found;
+
+        json = load(st);
+        if (json == NULL) {
+            return false;
+        }
+        sums = json_object_get(json, "checksums");
+        checksums.clear();
+        found = true;
+        for (auto&& algorithm : algorithms) {
+            entry = json_object_get(sums, algorithm.c_str());
+            sum = json_string_value(json_object_get(entry, "sum"));
+            if (sum == NULL) {
+                found = false;
+                break;
+            }
+            checksums.push_back(sum);
+            if (checksums.size() == 1 || (time_t) json_integer_value(json_object_get(entry, "verified")) < verified) {
+                verified = (time_t) json_integer_value(json_object_get(entry, "verified"));
+            }
+        }
+        json_decref(json);
+
+        if (found) {
+            utimes(entryPath(st).c_str(), NULL); /* recently used, allowed to fail */
+        }
+        return found;
+    }
+
+    /*
+     * Store the checksums of a file with the given status, which were
+     * computed just now, keeping the checksums of other algorithms that
+     * still apply with their own times. Return 0 or a negative errno.
+     */
+    int store(const struct stat& st,
+              const std::vector<std::string>& algorithms,
+              const std::vector<std::string>& checksums)
+    {
+        json_t* json;
+        json_t* sums;
+        json_t* entry;
+        std::string path, tmp;
+        time_t now;
+        size_t i;
+        int result;
+
+        result = makeDirs(st);
+        if (result < 0) {
+            return result;
+        }
+
+        json = load(st);
+        if (json == NULL) {
+            json = json_object();
+            json_object_set_new(json, "size", json_integer((json_int_t) st.st_size));
+            json_object_set_new(json, "mtime", json_integer((json_int_t) st.st_mtim.tv_sec));
+            json_object_set_new(json, "mtimeNsec", json_integer((json_int_t) st.st_mtim.tv_nsec));
+            json_object_set_new(json, "ctime", json_integer((json_int_t) st.st_ctim.tv_sec));
+            json_object_set_new(json, "ctimeNsec", json_integer((json_int_t) st.st_ctim.tv_nsec));
+            json_object_set_new(json, "checksums", json_object());
+        }
+        sums = json_object_get(json, "checksums");
+        now = time(NULL);
+        for (i = 0; i < algorithms.size() && i < checksums.size(); i++) {
+            entry = json_object();
+            json_object_set_new(entry, "sum", json_string(checksums[i].c_str()));
+            json_object_set_new(entry, "verified", json_integer((json_int_t) now));
+            json_object_set_new(sums, algorithms[i].c_str(), entry);
+        }
+
+        /*
+         * the name of the temporary file is unique per process and thread,
+         * so that concurrent stores of one entry never share it
+         */
+        path = entryPath(st);
+        tmp = path + ".tmp." + std::to_string((long long) getpid()) + "." +
+              std::to_string((unsigned long long) std::hash<std::thread::id>()(std::this_thread::get_id()));
+        result = json_dump_file(json, tmp.c_str(), JSON_COMPACT);
+        json_decref(json);
+        if (result != 0) {
+            unlink(tmp.c_str());
+            return -EIO;
+        }
+        if (rename(tmp.c_str(), path.c_str()) < 0) {
+            result = -errno;
+            unlink(tmp.c_str());
+            return result;
+        }
+
+        prune(path.substr(0, path.rfind('/')));
+        return 0;
+    }
+
+  private:
+    /*
+     * path of the entry of a file
+     */
+    std::string entryPath(const struct stat& st)
+    {
+        char name[64];
+
+        snprintf(name,
+                 sizeof(name),
+                 "%02x/%llx-%llx",
+                 (unsigned int) (st.st_ino & 0xff),
+                 (unsigned long long) st.st_dev,
+                 (unsigned long long) st.st_ino);
+        return dir + "/" + name;
+    }
+
+    /*
+     * load the entry of a file, or NULL if there is none that applies
+     */
+    json_t* load(const struct stat& st)
+    {
+        struct stat cached;
+        json_t* json;
+
+        json = json_load_file(entryPath(st).c_str(), 0, NULL);
+        if (json == NULL) {
+            return NULL;
+        }
+        cached = st;
+        cached.st_size = (off_t) json_integer_value(json_object_get(json, "size"));
+        cached.st_mtim.tv_sec = (time_t) json_integer_value(json_object_get(json, "mtime"));
+        cached.st_mtim.tv_nsec = (long) json_integer_value(json_object_get(json, "mtimeNsec"));
+        cached.st_ctim.tv_sec = (time_t) json_integer_value(json_object_get(json, "ctime"));
+        cached.st_ctim.tv_nsec = (long) json_integer_value(json_object_get(json, "ctimeNsec"));
+        if (!same(cached, st) || !json_is_object(json_object_get(json, "checksums"))) {
+            json_decref(json);
+            return NULL;
+        }
+        return json;
+    }
+
+    /*
+     * create the directories of the entry of a file, return 0 or a
+     * negative errno
+     */
+    int makeDirs(const struct stat& st)
+    {
+        std::string path;
+        size_t pos;
+
+        path = entryPath(st);
+        path = path.substr(0, path.rfind('/'));
+        for (pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+            if (mkdir(path.substr(0, pos).c_str(), 0700) < 0 && errno != EEXIST) {
+                return -errno;
+            }
+        }
+        if (mkdir(path.c_str(), 0700) < 0 && errno != EEXIST) {
+            return -errno;
+        }
+        return 0;
+    }
+
+    /*
+     * Evict the least recently used entries of a subdirectory beyond its
+     * share of the size limit, and temporary files left behind. A marker
+     * file records when the subdirectory was last pruned, so that this
+     * happens at most once per A_SUMCACHEPRUNE seconds.
+     */
+    void prune(const std::string& subdir)
+    {
+        std::vector<std::pair<time_t, std::pair<off_t, std::string>>> entries;
+        std::string marker, file;
+        struct dirent* entry;
+        struct stat st;
+        time_t now;
+        off_t total;
+        DIR* d;
+        int fd;
+
+        now = time(NULL);
+        marker = subdir + "/.pruned";
+        if (stat(marker.c_str(), &st) == 0 && now - st.st_mtime < A_SUMCACHEPRUNE) {
+            return;
+        }
+        fd = ::open(marker.c_str(), O_WRONLY | O_CREAT, 0600);
+        if (fd < 0) {
+            return;
+        }
+        close(fd);
+        utimes(marker.c_str(), NULL);
+
+        d = opendir(subdir.c_str());
+        if (d == NULL) {
+            return;
+        }
+        total = 0;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            file = subdir + "/" + entry->d_name;
+            if (stat(file.c_str(), &st) != 0) {
+                continue;
+            }
+            if (strstr(entry->d_name, ".tmp.") != NULL) {
+                if (now - st.st_mtime >= A_SUMCACHEPRUNE) {
+                    unlink(file.c_str()); /* allowed to fail */
+                }
+                continue;
+            }
+            entries.push_back(std::make_pair(st.st_mtime, std::make_pair(st.st_size, file)));
+            total += st.st_size;
+        }
+        closedir(d);
+
+        if (total > limit / 256) {
+            std::sort(entries.begin(), entries.end());
+            for (auto e = entries.begin(); e != entries.end() && total > limit / 256; e++) {
+                unlink(e->second.second.c_str()); /* allowed to fail */
+                total -= e->second.first;
+            }
+        }
+    }
+
+    std::string dir; /* directory of the cache of a resource */
+    off_t limit; /* maximum total size of the entries */
+};
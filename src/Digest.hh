@@ -0,0 +1,227 @@
+#pragma once
+
+#include <openssl/evp.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+/*
+ * Incremental message digest, producing checksums in the same format as
+ * iRODS: "sha2:<base64>" for SHA256, "sha512:<base64>" for SHA512,
+ * "sha1:<base64>" for SHA1 and plain hexadecimal for MD5. Adler-32, which
+ * iRODS does not use but transfer partners may want, is eight hexadecimal
+ * digits.
+ */
+class Digest
+{
+  public:
+    Digest(const std::string& algorithm)
+        : algorithm(algorithm)
+        , ctx(NULL)
+        , adler(false)
+        , sum(0)
+    {
+        const EVP_MD* md;
+
+        if (algorithm == "adler32") {
+            adler = true;
+            sum = adler32(0L, Z_NULL, 0);
+        }
+        md = implementation(algorithm);
+        if (md != NULL) {
+            ctx = EVP_MD_CTX_new();
+            if (ctx != NULL && EVP_DigestInit_ex(ctx, md, NULL) != 1) {
+                EVP_MD_CTX_free(ctx);
+                ctx = NULL;
+            }
+        }
+    }
+
+    ~Digest()
+    {
+        if (ctx != NULL) {
+            EVP_MD_CTX_free(ctx);
+        }
+    }
+
+    Digest(const Digest&) = delete;
+    Digest& operator=(const Digest&) = delete;
+
+    /*
+     * Obtain the OpenSSL implementation of an algorithm, or NULL if not
+     * supported. Implementations are looked up once, rather than for every
+     * digest. OpenSSL itself selects the fastest code for the CPU when it
+     * is loaded: SHA extensions, ARMv8 crypto extensions or AVX2, with a
+     * portable fallback.
+     */
+    static const EVP_MD* implementation(const std::string& algorithm)
+    {
+        static const EVP_MD* sha256 = fetch("SHA256");
+        static const EVP_MD* sha512 = fetch("SHA512");
+        static const EVP_MD* sha1 = fetch("SHA1");
+        static const EVP_MD* md5 = fetch("MD5");
+
+        if (algorithm == "sha256") {
+            return sha256;
+        }
+        if (algorithm == "sha512") {
+            return sha512;
+        }
+        if (algorithm == "sha1") {
+            return sha1;
+        }
+        if (algorithm == "md5") {
+            return md5;
+        }
+        return NULL;
+    }
+
+    /*
+     * the SHA-256 acceleration that OpenSSL uses on this CPU, unless told
+     * otherwise with OPENSSL_ia32cap
+     */
+    static const char* acceleration()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            if ((ebx & (1U << 29)) != 0) {
+                return "SHA extensions";
+            }
+            if ((ebx & (1U << 5)) != 0) {
+                return "AVX2";
+            }
+        }
+#elif defined(__aarch64__)
+        if ((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0) {
+            return "ARMv8 crypto extensions";
+        }
+#endif
+        return "none";
+    }
+
+    /*
+     * determine the algorithm of an iRODS checksum, or an empty string if
+     * not supported
+     */
+    static std::string algorithmOf(const char* checksum)
+    {
+        if (strncmp(checksum, "sha2:", 5) == 0) {
+            return "sha256";
+        }
+        if (strncmp(checksum, "sha512:", 7) == 0) {
+            return "sha512";
+        }
+        if (strncmp(checksum, "sha1:", 5) == 0) {
+            return "sha1";
+        }
+        if (strlen(checksum) == 32 && strspn(checksum, "0123456789abcdef") == 32) {
+            return "md5";
+        }
+        return "";
+    }
+
+    /*
+     * is the algorithm supported?
+     */
+    bool valid()
+    {
+        return (ctx != NULL || adler);
+    }
+
+    /*
+     * add data to the digest
+     */
+    void update(const void* buf, size_t len)
+    {
+        if (ctx != NULL) {
+            EVP_DigestUpdate(ctx, buf, len);
+        }
+        else if (adler) {
+            /*
+             * adler32() takes at most 4 GiB at a time
+             */
+            for (; len > 0x40000000; len -= 0x40000000, buf = (const char*) buf + 0x40000000) {
+                sum = adler32(sum, (const Bytef*) buf, 0x40000000);
+            }
+            sum = adler32(sum, (const Bytef*) buf, (uInt) len);
+        }
+    }
+
+    /*
+     * finish the digest and return it in binary, or an empty string on
+     * failure
+     */
+    std::string value()
+    {
+        unsigned char md[EVP_MAX_MD_SIZE];
+        unsigned int len;
+
+        if (adler) {
+            md[0] = (unsigned char) (sum >> 24);
+            md[1] = (unsigned char) (sum >> 16);
+            md[2] = (unsigned char) (sum >> 8);
+            md[3] = (unsigned char) sum;
+            return std::string((char*) md, 4);
+        }
+        if (ctx == NULL || EVP_DigestFinal_ex(ctx, md, &len) != 1) {
+            return "";
+        }
+        return std::string((char*) md, len);
+    }
+
+    /*
+     * finish the digest and return it as an iRODS checksum
+     */
+    std::string checksum()
+    {
+        return format(value());
+    }
+
+    /*
+     * convert a binary digest to an iRODS checksum
+     */
+    std::string format(const std::string& md)
+    {
+        unsigned char str[2 * EVP_MAX_MD_SIZE + 1];
+
+        if (md.empty() || md.length() > EVP_MAX_MD_SIZE) {
+            return "";
+        }
+        if (adler || algorithm == "md5") {
+            for (size_t i = 0; i < md.length(); i++) {
+                snprintf((char*) &str[2 * i], 3, "%02x", (unsigned char) md[i]);
+            }
+            return std::string((char*) str, 2 * md.length());
+        }
+        EVP_EncodeBlock(str, (const unsigned char*) md.data(), (int) md.length());
+        return std::string((algorithm == "sha256") ? "sha2:" : algorithm + ":") + (char*) str;
+    }
+
+  private:
+    /*
+     * look up an OpenSSL implementation
+     */
+    static const EVP_MD* fetch(const char* name)
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        return EVP_MD_fetch(NULL, name, NULL);
+#else
+        return EVP_get_digestbyname(name);
+#endif
+    }
+
+    std::string algorithm; /* name of the algorithm */
+    EVP_MD_CTX* ctx; /* OpenSSL digest context */
+    bool adler; /* Adler-32 instead of an OpenSSL digest? */
+    uLong sum; /* Adler-32 so far */
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "RateLimiter.hh"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#define A_HASHBLOCKSIZE ((size_t) 4 * 1024 * 1024)
+#define A_HASHALIGN     ((size_t) 4096) /* alignment of direct I/O buffers */
+
+/*
+ * Sequential reader of local files for hashing. Data is read in large
+ * aligned blocks. As soon as a file turns out to be larger than one block,
+ * a reader thread fills the next block while the caller processes the
+ * current one, so that reading and hashing overlap; small files are read
+ * without starting a thread. With direct I/O the page cache is bypassed, so
+ * that scrubbing a vault does not evict data that is in use. Otherwise the
+ * kernel is told that the file is read sequentially, and only once.
+ *
+ * Reads can be charged to a RateLimiter, so that background scrubbing has a
+ * bounded impact on the disks.
+ *
+ * A FileHasher can be reused for many files, one at a time. The reader
+ * thread must not call back into iRODS, and neither does it.
+ */
+class FileHasher
+{
+  public:
+    FileHasher(size_t blockSize = A_HASHBLOCKSIZE)
+        : blockSize((blockSize + A_HASHALIGN - 1) / A_HASHALIGN * A_HASHALIGN)
+        , remaining(-1)
+        , fd(-1)
+        , direct(false)
+        , limiter(NULL)
+    {
+        for (int i = 0; i < 2; i++) {
+            if (posix_memalign((void**) &buffers[i], A_HASHALIGN, this->blockSize) != 0) {
+                buffers[i] = NULL;
+            }
+        }
+    }
+
+    ~FileHasher()
+    {
+        close();
+        free(buffers[0]);
+        free(buffers[1]);
+    }
+
+    FileHasher(const FileHasher&) = delete;
+    FileHasher& operator=(const FileHasher&) = delete;
+
+    /*
+     * Open a file, with direct I/O if requested and supported by the file
+     * system. Extra open flags such as O_NOFOLLOW may be given. Return 0 or
+     * a negative errno.
+     */
+    int open(const char* path, bool direct = false, int flags = 0)
+    {
+        close();
+        if (buffers[0] == NULL || buffers[1] == NULL) {
+            return -ENOMEM;
+        }
+        if (direct) {
+            fd = ::open(path, O_RDONLY | O_CLOEXEC | O_DIRECT | flags);
+            if (fd < 0 && errno != EINVAL) {
+                return -errno;
+            }
+        }
+        if (fd < 0) {
+            /*
+             * EINVAL: direct I/O is not supported here
+             */
+            fd = ::open(path, O_RDONLY | O_CLOEXEC | flags);
+            if (fd < 0) {
+                return -errno;
+            }
+        }
+        if (fstat(fd, &st) < 0) {
+            int err = errno;
+            close();
+            return -err;
+        }
+
+        this->direct = ((fcntl(fd, F_GETFL) & O_DIRECT) != 0);
+        if (!this->direct) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); /* allowed to fail */
+            posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+        }
+        return 0;
+    }
+
+    /*
+     * charge every read to a budget, or to none if NULL
+     */
+    void limit(RateLimiter* limiter)
+    {
+        this->limiter = limiter;
+    }
+
+    /*
+     * status of the open file
+     */
+    const struct stat& status()
+    {
+        return st;
+    }
+
+    /*
+     * Read the open file from start to end, or length bytes from offset,
+     * passing every block to consume, in order. Return 0 or a negative
+     * errno.
+     */
+    int read(const std::function<void(const char*, size_t)>& consume, off_t offset = 0, off_t length = -1)
+    {
+        ssize_t len;
+        size_t i;
+
+        if (fd < 0) {
+            return -EBADF;
+        }
+        if (lseek(fd, offset, SEEK_SET) < 0) {
+            return -errno;
+        }
+        remaining = length;
+        len = fill(0);
+        if (len <= 0 || (size_t) len < blockSize) {
+            if (len > 0) {
+                consume(buffers[0], (size_t) len);
+            }
+            return (len < 0) ? (int) len : 0;
+        }
+
+        /*
+         * larger than one block: read ahead on a separate thread
+         */
+        full[0] = true;
+        lengths[0] = len;
+        full[1] = false;
+        std::thread reader(&FileHasher::readAhead, this);
+        for (i = 0;; i ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this, i] { return full[i]; });
+                len = lengths[i];
+            }
+            if (len <= 0) {
+                break;
+            }
+            consume(buffers[i], (size_t) len);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                full[i] = false;
+            }
+            changed.notify_all();
+        }
+        reader.join();
+
+        return (len < 0) ? (int) len : 0;
+    }
+
+    /*
+     * close the open file, if any
+     */
+    void close()
+    {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+  private:
+    /*
+     * fill the other buffers until the end of the file, or an error
+     */
+    void readAhead()
+    {
+        ssize_t len;
+        size_t i;
+
+        for (i = 1;; i ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this, i] { return !full[i]; });
+            }
+            len = fill(i);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                full[i] = true;
+                lengths[i] = len;
+            }
+            changed.notify_all();
+            if (len <= 0) {
+                break;
+            }
+        }
+    }
+
+    /*
+     * Fill a buffer, return the number of bytes read, which is less than a
+     * full block only at the end of the file or range, or a negative errno.
+     */
+    ssize_t fill(size_t i)
+    {
+        size_t want;
+        size_t done;
+        ssize_t len;
+
+        want = (remaining >= 0 && (size_t) remaining < blockSize) ? (size_t) remaining : blockSize;
+        for (done = 0; done < want; done += (size_t) len) {
+            len = ::read(fd, buffers[i] + done, want - done);
+            if (len < 0) {
+                if (errno == EINTR) {
+                    len = 0;
+                    continue;
+                }
+                if (errno == EINVAL && direct) {
+                    /*
+                     * a short read left the offset unaligned, continue
+                     * through the page cache
+                     */
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                    direct = false;
+                    len = 0;
+                    continue;
+                }
+                return -errno;
+            }
+            if (len == 0) {
+                break; /* the end of the file costs no budget */
+            }
+            if (limiter != NULL) {
+                limiter->acquire((size_t) len);
+            }
+        }
+        if (remaining >= 0) {
+            remaining -= (off_t) done;
+        }
+        return (ssize_t) done;
+    }
+
+    size_t blockSize; /* size of a buffer, a multiple of A_HASHALIGN */
+    char* buffers[2]; /* aligned buffers, filled in turn */
+    bool full[2]; /* does the buffer hold data not yet consumed? */
+    ssize_t lengths[2]; /* bytes in a full buffer, 0 at the end, or a negative errno */
+    std::mutex mutex; /* protects full and lengths */
+    std::condition_variable changed; /* a buffer was filled or consumed */
+    struct stat st; /* status of the open file */
+    off_t remaining; /* bytes left to read in the range, or -1 for the rest of the file */
+    int fd; /* open file, or -1 */
+    bool direct; /* is direct I/O in use? */
+    RateLimiter* limiter; /* budget to charge reads to, or NULL */
+};
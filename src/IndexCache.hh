@@ -0,0 +1,177 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define A_CACHEDIR  "/var/lib/irods/.archive_index_cache"
+#define A_CACHESIZE ((off_t) 1024 * 1024 * 1024)
+
+/*
+ * On-disk cache of archive indexes, shared by all agents on a server. Entries
+ * are keyed by the data ID, modification time, size and checksum of the
+ * archive, so a modified archive never matches a stale entry. The least
+ * recently used entries are evicted when the total size exceeds the limit.
+ * Archive stores indexes here in binary form (see Cbor.hh), which decodes
+ * faster than JSON text parses.
+ */
+class IndexCache
+{
+  public:
+    IndexCache(const char* dir = A_CACHEDIR, off_t limit = A_CACHESIZE)
+        : dir(dir)
+        , limit(limit)
+    {
+        mkdir(dir, 0700); /* allowed to fail */
+    }
+
+    /*
+     * determine the cache key of an archive from its catalog information
+     */
+    static std::string key(const rodsObjStat_t* objStat)
+    {
+        std::string key;
+
+        if (objStat != NULL && objStat->dataId[0] != '\0') {
+            key = std::string(objStat->dataId) + "-" + objStat->modifyTime + "-" +
+                  std::to_string(objStat->objSize) + "-" + objStat->chksum;
+
+            /*
+             * checksums may contain characters that are not allowed in
+             * filenames
+             */
+            for (auto c = key.begin(); c != key.end(); c++) {
+                if (!isalnum((unsigned char) *c) && *c != '-') {
+                    *c = '_';
+                }
+            }
+        }
+
+        return key;
+    }
+
+    /*
+     * retrieve a cached index, marking it as recently used
+     */
+    bool get(const std::string& key, std::string& index)
+    {
+        std::string file;
+        struct stat st;
+        char* buf;
+        int fd;
+        bool found;
+
+        if (key.empty()) {
+            return false;
+        }
+        file = dir + "/" + key;
+        fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        found = false;
+        if (fstat(fd, &st) == 0) {
+            buf = new char[(size_t) st.st_size];
+            if (read(fd, buf, (size_t) st.st_size) == (ssize_t) st.st_size) {
+                index.assign(buf, (size_t) st.st_size);
+                found = true;
+            }
+            delete[] buf;
+        }
+        close(fd);
+
+        if (found) {
+            utimes(file.c_str(), NULL);
+        }
+        return found;
+    }
+
+    /*
+     * is an index cached?
+     */
+    bool contains(const std::string& key)
+    {
+        return (!key.empty() && access((dir + "/" + key).c_str(), F_OK) == 0);
+    }
+
+    /*
+     * store an index in the cache, evicting old entries if needed
+     */
+    void put(const std::string& key, const std::string& index)
+    {
+        std::string file, tmp;
+        ssize_t len;
+        int fd;
+
+        if (key.empty()) {
+            return;
+        }
+        file = dir + "/" + key;
+        tmp = dir + "/." + key + "." + std::to_string(getpid());
+        fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            return;
+        }
+        len = write(fd, index.data(), index.length());
+        if (close(fd) != 0 || len != (ssize_t) index.length() || rename(tmp.c_str(), file.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return;
+        }
+
+        evict(key);
+    }
+
+  private:
+    /*
+     * remove entries for older versions of the same archive, and the least
+     * recently used entries beyond the size limit
+     */
+    void evict(const std::string& key)
+    {
+        std::vector<std::pair<time_t, std::pair<off_t, std::string>>> entries;
+        std::string id, file;
+        struct dirent* entry;
+        struct stat st;
+        off_t total;
+        DIR* d;
+
+        id = key.substr(0, key.find('-') + 1);
+        d = opendir(dir.c_str());
+        if (d == NULL) {
+            return;
+        }
+        total = 0;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            file = dir + "/" + entry->d_name;
+            if (strncmp(entry->d_name, id.c_str(), id.length()) == 0 && key.compare(entry->d_name) != 0) {
+                unlink(file.c_str());
+            }
+            else if (stat(file.c_str(), &st) == 0) {
+                entries.push_back(std::make_pair(st.st_mtime, std::make_pair(st.st_size, file)));
+                total += st.st_size;
+            }
+        }
+        closedir(d);
+
+        if (total > limit) {
+            std::sort(entries.begin(), entries.end());
+            for (auto e = entries.begin(); e != entries.end() && total > limit; e++) {
+                unlink(e->second.second.c_str()); /* allowed to fail */
+                total -= e->second.first;
+            }
+        }
+    }
+
+    std::string dir; /* cache directory */
+    off_t limit; /* maximum total size of cached indexes */
+};
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <jansson.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define A_ARENASIZE ((size_t) 1024 * 1024)
+
+/*
+ * Table of the items harvested for a new archive. Every field is stored in
+ * its own column, strings are copied into a few large blocks, and owner and
+ * zone names are stored once. Distinct sets of attributes and ACLs are also
+ * stored once, and items refer to them by number. Items are only converted
+ * to JSON when the index is written.
+ */
+class ItemTable
+{
+    /*
+     * Strings are allocated from large blocks that are never freed
+     * individually.
+     */
+    class Arena
+    {
+      public:
+        Arena()
+            : used(A_ARENASIZE)
+        {
+        }
+
+        /*
+         * copy a string into the arena
+         */
+        const char* copy(const char* str, size_t len)
+        {
+            char* ptr;
+
+            if (len + 1 > A_ARENASIZE / 4) {
+                /*
+                 * large strings get a block of their own
+                 */
+                large.push_back(std::unique_ptr<char[]>(new char[len + 1]));
+                ptr = large.back().get();
+            }
+            else {
+                if (len + 1 > A_ARENASIZE - used) {
+                    blocks.push_back(std::unique_ptr<char[]>(new char[A_ARENASIZE]));
+                    used = 0;
+                }
+                ptr = blocks.back().get() + used;
+                used += len + 1;
+            }
+            memcpy(ptr, str, len);
+            ptr[len] = '\0';
+            return ptr;
+        }
+
+      private:
+        std::vector<std::unique_ptr<char[]>> blocks; /* allocated blocks, the last one is being filled */
+        std::vector<std::unique_ptr<char[]>> large; /* separately allocated large strings */
+        size_t used; /* bytes used in the last block */
+    };
+
+    /*
+     * Distinct JSON values, numbered in the order in which they were first
+     * added.
+     */
+    class SetTable
+    {
+      public:
+        SetTable()
+            : sets(json_array())
+        {
+        }
+
+        ~SetTable()
+        {
+            json_decref(sets);
+        }
+
+        /*
+         * obtain the number of a set, taking over the reference, or -1 for
+         * no set
+         */
+        int32_t intern(json_t* set)
+        {
+            char* str;
+
+            if (set == NULL) {
+                return -1;
+            }
+            str = json_dumps(set, JSON_COMPACT | JSON_SORT_KEYS);
+            std::string key = str;
+            free(str);
+
+            auto found = ids.find(key);
+            if (found != ids.end()) {
+                json_decref(set);
+                return found->second;
+            }
+            json_array_append_new(sets, set);
+            ids[key] = (int32_t) (json_array_size(sets) - 1);
+            return (int32_t) (json_array_size(sets) - 1);
+        }
+
+        json_t* sets; /* all sets */
+
+      private:
+        std::unordered_map<std::string, int32_t> ids; /* serialized set to number */
+    };
+
+  public:
+    /*
+     * orders in which items can be written
+     */
+    enum
+    {
+        ORDER_CATALOG, /* as harvested from the catalog */
+        ORDER_LOCATION, /* by resource and physical path of the replica */
+        ORDER_SIZE /* by size class, smallest first */
+    };
+
+    ItemTable()
+    {
+    }
+
+    ItemTable(const ItemTable&) = delete;
+    ItemTable& operator=(const ItemTable&) = delete;
+
+    /*
+     * Add an item, taking over the references to attributes and acl, which
+     * may be NULL. Collections have a NULL checksum. The resource hierarchy
+     * and physical path of the replica to read are optional, and so is the
+     * collection that the name is relative to, if it differs from the
+     * collection of the archive.
+     */
+    void add(const std::string& name,
+             const char* checksum,
+             size_t size,
+             time_t created,
+             time_t modified,
+             const std::string& owner,
+             const std::string& zone,
+             json_t* attr,
+             json_t* acl,
+             const char* resource = NULL,
+             const char* location = NULL,
+             const char* origin = NULL)
+    {
+        if (checksum != NULL) {
+            checksum = (*checksum != '\0') ? arena.copy(checksum, strlen(checksum)) : "";
+        }
+        if (location != NULL) {
+            location = arena.copy(location, strlen(location));
+        }
+        names.push_back(arena.copy(name.c_str(), name.length()));
+        checksums.push_back(checksum);
+        sizes.push_back((int64_t) size);
+        offsets.push_back(-1);
+        ctimes.push_back((int64_t) created);
+        mtimes.push_back((int64_t) modified);
+        owners.push_back(intern(owner));
+        zones.push_back(intern(zone));
+        attributes.push_back(attributeSets.intern(attr));
+        acls.push_back(aclSets.intern(acl));
+        resources.push_back(intern((resource != NULL) ? resource : ""));
+        locations.push_back(location);
+        origins.push_back(internOrigin(origin));
+    }
+
+    /*
+     * Reorder the DataObjs. Collections stay in front, in the order in
+     * which they were added, so that they precede their contents.
+     */
+    void sort(int order)
+    {
+        std::vector<size_t> perm;
+        size_t i;
+
+        if (order != ORDER_LOCATION && order != ORDER_SIZE) {
+            return;
+        }
+        for (i = 0; i < size(); i++) {
+            perm.push_back(i);
+        }
+        std::stable_sort(perm.begin(), perm.end(), [this, order](size_t a, size_t b) {
+            int cmp;
+
+            if (isColl(a) || isColl(b)) {
+                return (isColl(a) && !isColl(b));
+            }
+            if (order == ORDER_SIZE) {
+                return (sizeClass(a) < sizeClass(b));
+            }
+            cmp = strings[resources[a]].compare(strings[resources[b]]);
+            if (cmp != 0) {
+                return (cmp < 0);
+            }
+            return (locations[a] != NULL && (locations[b] == NULL || strcmp(locations[a], locations[b]) < 0));
+        });
+
+        permute(names, perm);
+        permute(checksums, perm);
+        permute(sizes, perm);
+        permute(offsets, perm);
+        permute(ctimes, perm);
+        permute(mtimes, perm);
+        permute(owners, perm);
+        permute(zones, perm);
+        permute(attributes, perm);
+        permute(acls, perm);
+        permute(resources, perm);
+        permute(locations, perm);
+        permute(origins, perm);
+    }
+
+    /*
+     * obtain the number of a set of attributes, taking over the reference
+     */
+    int32_t internAttributes(json_t* attr)
+    {
+        return attributeSets.intern(attr);
+    }
+
+    /*
+     * obtain the number of an ACL, taking over the reference
+     */
+    int32_t internACL(json_t* acl)
+    {
+        return aclSets.intern(acl);
+    }
+
+    /*
+     * obtain the number of an origin, or -1 for none
+     */
+    int32_t internOrigin(const char* origin)
+    {
+        size_t i;
+
+        if (origin == NULL) {
+            return -1;
+        }
+        for (i = 0; i < originNames.size(); i++) {
+            if (originNames[i].compare(origin) == 0) {
+                return (int32_t) i;
+            }
+        }
+        originNames.push_back(origin);
+        return (int32_t) i;
+    }
+
+    /*
+     * all distinct sets of attributes
+     */
+    json_t* attributeList()
+    {
+        return attributeSets.sets;
+    }
+
+    /*
+     * all distinct ACLs
+     */
+    json_t* aclList()
+    {
+        return aclSets.sets;
+    }
+
+    /*
+     * all distinct origins, or NULL if every item is relative to the
+     * collection of the archive
+     */
+    json_t* originList()
+    {
+        json_t* list;
+
+        if (originNames.empty()) {
+            return NULL;
+        }
+        list = json_array();
+        for (size_t i = 0; i < originNames.size(); i++) {
+            json_array_append_new(list, json_string(originNames[i].c_str()));
+        }
+        return list;
+    }
+
+    /*
+     * number of items
+     */
+    size_t size()
+    {
+        return names.size();
+    }
+
+    const char* name(size_t i)
+    {
+        return names[i];
+    }
+
+    bool isColl(size_t i)
+    {
+        return (checksums[i] == NULL);
+    }
+
+    size_t dataSize(size_t i)
+    {
+        return (size_t) sizes[i];
+    }
+
+    time_t modified(size_t i)
+    {
+        return (time_t) mtimes[i];
+    }
+
+    /*
+     * resource hierarchy of the replica to read, or empty for any replica
+     */
+    const std::string& resourceHierarchy(size_t i)
+    {
+        return strings[resources[i]];
+    }
+
+    /*
+     * collection that the name of an item is relative to, or empty for the
+     * collection of the archive
+     */
+    std::string origin(size_t i)
+    {
+        return (origins[i] >= 0) ? originNames[(size_t) origins[i]] : "";
+    }
+
+    /*
+     * collection with the given number in the list of origins
+     */
+    const std::string& originName(size_t n)
+    {
+        return originNames[n];
+    }
+
+    /*
+     * record where the data of a DataObj starts in an uncompressed archive
+     */
+    void setOffset(size_t i, int64_t offset)
+    {
+        offsets[i] = offset;
+    }
+
+    /*
+     * convert an item to its INDEX.json representation, referring to
+     * attributes and ACL by number
+     */
+    json_t* json(size_t i)
+    {
+        json_t* json;
+
+        json = json_object();
+        json_object_set_new(json, "name", json_string(names[i]));
+        if (isColl(i)) {
+            json_object_set_new(json, "type", json_string("coll"));
+        }
+        else {
+            json_object_set_new(json, "type", json_string("dataObj"));
+            json_object_set_new(json, "size", json_integer(sizes[i]));
+            if (offsets[i] >= 0) {
+                json_object_set_new(json, "offset", json_integer(offsets[i]));
+            }
+        }
+        json_object_set_new(json, "created", json_integer(ctimes[i]));
+        json_object_set_new(json, "modified", json_integer(mtimes[i]));
+        json_object_set_new(json, "owner", json_string((strings[owners[i]] + "#" + strings[zones[i]]).c_str()));
+        if (checksums[i] != NULL && *checksums[i] != '\0') {
+            json_object_set_new(json, "checksum", json_string(checksums[i]));
+        }
+        if (attributes[i] >= 0) {
+            json_object_set_new(json, "attributes", json_integer(attributes[i]));
+        }
+        if (acls[i] >= 0) {
+            json_object_set_new(json, "ACL", json_integer(acls[i]));
+        }
+        if (origins[i] >= 0) {
+            json_object_set_new(json, "origin", json_integer(origins[i]));
+        }
+        return json;
+    }
+
+  private:
+    /*
+     * size class of a DataObj: the number of significant bits in its size
+     */
+    int sizeClass(size_t i)
+    {
+        uint64_t size;
+        int bits;
+
+        for (size = (uint64_t) sizes[i], bits = 0; size != 0; size >>= 1) {
+            bits++;
+        }
+        return bits;
+    }
+
+    /*
+     * reorder a column
+     */
+    template<typename T> static void permute(std::vector<T>& column, const std::vector<size_t>& perm)
+    {
+        std::vector<T> sorted;
+
+        sorted.reserve(column.size());
+        for (size_t i = 0; i < perm.size(); i++) {
+            sorted.push_back(column[perm[i]]);
+        }
+        column.swap(sorted);
+    }
+
+    /*
+     * obtain the number of a string stored only once
+     */
+    uint32_t intern(const std::string& str)
+    {
+        auto found = interned.find(str);
+        if (found != interned.end()) {
+            return found->second;
+        }
+        strings.push_back(str);
+        interned[str] = (uint32_t) (strings.size() - 1);
+        return (uint32_t) (strings.size() - 1);
+    }
+
+    Arena arena; /* storage for names and checksums */
+    std::vector<std::string> strings; /* interned strings */
+    std::unordered_map<std::string, uint32_t> interned; /* string to number */
+    std::vector<const char*> names; /* item names */
+    std::vector<const char*> checksums; /* checksums, empty if unknown, NULL for collections */
+    std::vector<int64_t> sizes; /* DataObj sizes */
+    std::vector<int64_t> offsets; /* DataObj offsets in the archive, or -1 */
+    std::vector<int64_t> ctimes; /* creation times */
+    std::vector<int64_t> mtimes; /* modification times */
+    std::vector<uint32_t> owners; /* interned owner names */
+    std::vector<uint32_t> zones; /* interned owner zones */
+    std::vector<int32_t> attributes; /* numbers of attribute sets, or -1 */
+    std::vector<int32_t> acls; /* numbers of ACLs, or -1 */
+    std::vector<uint32_t> resources; /* interned resource hierarchies of the replicas to read */
+    std::vector<const char*> locations; /* physical paths of the replicas to read, or NULL */
+    std::vector<int32_t> origins; /* numbers of origins, or -1 */
+    std::vector<std::string> originNames; /* distinct origins, few */
+    SetTable attributeSets; /* distinct sets of attributes */
+    SetTable aclSets; /* distinct ACLs */
+};
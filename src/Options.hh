@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+ * Optional settings of a microservice, passed as a key-value pair parameter:
+ *
+ *   msiString2KeyValPair("resource=demoResc++++sidecar=1", *options);
+ *
+ * For backward compatibility, a string parameter is taken to be the value of
+ * a single default key.
+ */
+class Options
+{
+  public:
+    Options(msParam_t* param, const char* defaultKey)
+        : kvp(NULL)
+        , str(NULL)
+        , defaultKey(defaultKey)
+    {
+        if (param != NULL && param->type != NULL) {
+            if (strcmp(param->type, KeyValPair_MS_T) == 0) {
+                kvp = (keyValPair_t*) param->inOutStruct;
+            }
+            else if (strcmp(param->type, STR_MS_T) == 0) {
+                str = parseMspForStr(param);
+            }
+        }
+    }
+
+    /*
+     * get an option as a string, or NULL if not set
+     */
+    const char* get(const char* key)
+    {
+        if (kvp != NULL) {
+            return getValByKey(kvp, key);
+        }
+        if (str != NULL && defaultKey != NULL && strcmp(key, defaultKey) == 0) {
+            return str;
+        }
+        return NULL;
+    }
+
+    /*
+     * get an option as an integer
+     */
+    long long integer(const char* key, long long value)
+    {
+        const char* val = get(key);
+        char* end;
+
+        if (val != NULL && *val != '\0') {
+            long long i = strtoll(val, &end, 10);
+            if (*end == '\0') {
+                value = i;
+            }
+        }
+        return value;
+    }
+
+    /*
+     * get an option as a boolean
+     */
+    bool flag(const char* key)
+    {
+        const char* val = get(key);
+
+        return (val != NULL && (strcmp(val, "1") == 0 || strcmp(val, "true") == 0 || strcmp(val, "yes") == 0));
+    }
+
+    /*
+     * get an option as a comma separated list, without empty elements
+     */
+    std::vector<std::string> list(const char* key)
+    {
+        std::vector<std::string> list;
+        const char* val = get(key);
+        size_t len;
+
+        while (val != NULL && *val != '\0') {
+            len = strcspn(val, ",");
+            if (len != 0) {
+                list.push_back(std::string(val, len));
+            }
+            val += (val[len] == ',') ? len + 1 : len;
+        }
+        return list;
+    }
+
+    /*
+     * all options except one, as a string that msiString2KeyValPair accepts
+     */
+    std::string serialize(const char* skip)
+    {
+        std::string options;
+
+        if (kvp != NULL) {
+            for (int i = 0; i < kvp->len; i++) {
+                if (strcmp(kvp->keyWord[i], skip) != 0) {
+                    options += std::string(options.empty() ? "" : "++++") + kvp->keyWord[i] + "=" + kvp->value[i];
+                }
+            }
+        }
+        else if (str != NULL && defaultKey != NULL && strcmp(defaultKey, skip) != 0) {
+            options = std::string(defaultKey) + "=" + str;
+        }
+        return options;
+    }
+
+    /*
+     * obtain a non-negative integer from an optional string or integer
+     * parameter, or SYS_INVALID_INPUT_PARAM
+     */
+    static long long intParam(msParam_t* param)
+    {
+        if (param->type == NULL) {
+            return 0;
+        }
+        if (strcmp(param->type, INT_MS_T) == 0) {
+            return *(int*) param->inOutStruct;
+        }
+        if (strcmp(param->type, STR_MS_T) == 0) {
+            const char* str = parseMspForStr(param);
+            char* end;
+            long long value;
+
+            if (str == NULL || *str == '\0') {
+                return 0;
+            }
+            value = strtoll(str, &end, 10);
+            return (*end == '\0') ? value : SYS_INVALID_INPUT_PARAM;
+        }
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+  private:
+    keyValPair_t* kvp; /* key-value pairs */
+    const char* str; /* value of the default key */
+    const char* defaultKey; /* key of a plain string value */
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#define A_RATESEGMENT "/irods_uu_checksum_rate"
+#define A_RATEBURST   ((int64_t) 100 * 1000 * 1000) /* nanoseconds of budget that may be used at once */
+
+/*
+ * Bandwidth and IOPS budget for reading local files, shared by all agents
+ * on a server. Each budget is a token bucket, kept as the time at which it
+ * will be full again (the generic cell rate algorithm), in a small shared
+ * memory segment. Charging a read moves that time forward atomically, and
+ * the reader waits while the bucket is in debt. A segment filled with
+ * zeroes is a full bucket, so the segment needs no initialization and no
+ * lock.
+ *
+ * Concurrent calls should use the same budget; each charges at its own
+ * rate. If the segment cannot be created, the budget applies to this
+ * limiter alone.
+ */
+class RateLimiter
+{
+    struct Segment
+    {
+        std::atomic<int64_t> bytes; /* when the bandwidth bucket is full, in ns of CLOCK_MONOTONIC */
+        std::atomic<int64_t> ops; /* when the IOPS bucket is full */
+    };
+
+    static_assert(std::atomic<int64_t>::is_always_lock_free, "shared counters must be lock free");
+
+  public:
+    /*
+     * limit to bytesPerSecond and opsPerSecond, where 0 means no limit
+     */
+    RateLimiter(long long bytesPerSecond, long long opsPerSecond)
+        : bytesPerSecond(std::max(bytesPerSecond, 0LL))
+        , opsPerSecond(std::max(opsPerSecond, 0LL))
+        , segment(&local)
+    {
+        void* ptr;
+        int fd;
+
+        local.bytes = 0;
+        local.ops = 0;
+        fd = shm_open(A_RATESEGMENT, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd >= 0) {
+            if (ftruncate(fd, sizeof(Segment)) == 0) {
+                ptr = mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (ptr != MAP_FAILED) {
+                    segment = (Segment*) ptr;
+                }
+            }
+            close(fd);
+        }
+    }
+
+    ~RateLimiter()
+    {
+        if (segment != &local) {
+            munmap(segment, sizeof(Segment));
+        }
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    /*
+     * is the budget shared with other agents?
+     */
+    bool shared()
+    {
+        return (segment != &local);
+    }
+
+    /*
+     * charge a read of len bytes, waiting while the budget is in debt
+     */
+    void acquire(size_t len)
+    {
+        int64_t wait;
+
+        wait = 0;
+        if (bytesPerSecond != 0) {
+            wait = std::max(wait, reserve(segment->bytes, (int64_t) ((double) len * 1e9 / (double) bytesPerSecond)));
+        }
+        if (opsPerSecond != 0) {
+            wait = std::max(wait, reserve(segment->ops, (int64_t) (1e9 / (double) opsPerSecond)));
+        }
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+    }
+
+  private:
+    /*
+     * Charge a bucket, return the nanoseconds to wait until earlier charges
+     * are covered, or a negative number if they already are.
+     */
+    static int64_t reserve(std::atomic<int64_t>& full, int64_t cost)
+    {
+        struct timespec ts;
+        int64_t now, old;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+        old = full.load();
+        while (!full.compare_exchange_weak(old, std::max(old, now) + cost)) {
+        }
+        return old - A_RATEBURST - now;
+    }
+
+    long long bytesPerSecond; /* bandwidth budget, or 0 */
+    long long opsPerSecond; /* IOPS budget, or 0 */
+    Segment local; /* budget of this limiter alone, if there is no shared segment */
+    Segment* segment; /* shared budget, or local */
+};
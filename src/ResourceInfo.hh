@@ -0,0 +1,110 @@
+#pragma once
+
+#include "rsGenQuery.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define A_RESCINFOTTL 60 /* seconds that the information about a resource is reused */
+
+/*
+ * Information about a resource that the vault microservices need: its ID,
+ * type, vault path and location. Lookups are cached by resource name for
+ * A_RESCINFOTTL seconds, so that rules calling these microservices many
+ * times do not query the catalog for the same resource every time.
+ */
+class ResourceInfo
+{
+  public:
+    ResourceInfo()
+        : id(0)
+        , looked(0)
+    {
+    }
+
+    /*
+     * Look up a resource by name. Return 0, CAT_UNKNOWN_RESOURCE if there
+     * is no such resource, or another iRODS error.
+     */
+    static int lookup(rsComm_t* rsComm, const char* name, ResourceInfo& info)
+    {
+        static std::mutex mutex;
+        static std::unordered_map<std::string, ResourceInfo> cache;
+        char condStr[MAX_NAME_LEN];
+        genQueryInp_t genQueryInp;
+        genQueryOut_t* genQueryOut;
+        time_t now;
+        int status;
+
+        now = time(NULL);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto found = cache.find(name);
+            if (found != cache.end() && now - found->second.looked < A_RESCINFOTTL) {
+                info = found->second;
+                return 0;
+            }
+        }
+
+        memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
+        snprintf(condStr, MAX_NAME_LEN, "='%s'", name);
+        addInxVal(&genQueryInp.sqlCondInp, COL_R_RESC_NAME, condStr);
+        addInxIval(&genQueryInp.selectInp, COL_R_RESC_ID, 1);
+        addInxIval(&genQueryInp.selectInp, COL_R_TYPE_NAME, 1);
+        addInxIval(&genQueryInp.selectInp, COL_R_VAULT_PATH, 1);
+        addInxIval(&genQueryInp.selectInp, COL_R_LOC, 1);
+        genQueryInp.maxRows = 1;
+        genQueryOut = NULL;
+        status = rsGenQuery(rsComm, &genQueryInp, &genQueryOut);
+        if (status == CAT_NO_ROWS_FOUND || (status >= 0 && genQueryOut->rowCnt != 1)) {
+            status = CAT_UNKNOWN_RESOURCE;
+        }
+        if (status >= 0) {
+            info.id = strtoll(getSqlResultByInx(genQueryOut, COL_R_RESC_ID)->value, NULL, 10);
+            info.type = getSqlResultByInx(genQueryOut, COL_R_TYPE_NAME)->value;
+            info.vaultPath = getSqlResultByInx(genQueryOut, COL_R_VAULT_PATH)->value;
+            while (info.vaultPath.length() > 1 && info.vaultPath.back() == '/') {
+                info.vaultPath.pop_back();
+            }
+            info.location = getSqlResultByInx(genQueryOut, COL_R_LOC)->value;
+            info.looked = now;
+            status = 0;
+        }
+        clearGenQueryInp(&genQueryInp);
+        freeGenQueryOut(&genQueryOut);
+
+        if (status == 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cache[name] = info;
+        }
+        return status;
+    }
+
+    /*
+     * is a lexically normalized physical path inside the vault? Nothing is
+     * inside a vault without a path.
+     */
+    bool inVault(const std::string& path)
+    {
+        if (vaultPath.empty() || vaultPath[0] != '/') {
+            return false;
+        }
+        if (vaultPath == "/") {
+            return (path.length() > 1 && path[0] == '/');
+        }
+        return (path.compare(0, vaultPath.length(), vaultPath) == 0 && path.length() > vaultPath.length() + 1 &&
+                path[vaultPath.length()] == '/');
+    }
+
+    rodsLong_t id; /* resource ID */
+    std::string type; /* resource type, such as "unixfilesystem" */
+    std::string vaultPath; /* vault path, without trailing slash */
+    std::string location; /* host name of the server that holds the vault */
+
+  private:
+    time_t looked; /* time of the catalog lookup */
+};
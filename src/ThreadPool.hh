@@ -0,0 +1,148 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed pool of worker threads. Every worker has its own queue (lane), and
+ * tasks submitted to the same lane are run in order. Submitting blocks while
+ * the lane is full, which bounds the memory held by queued tasks.
+ *
+ * The threads must not call back into iRODS: the server API is only safe to
+ * use from the agent thread.
+ */
+class ThreadPool
+{
+    class Lane
+    {
+      public:
+        Lane()
+            : busy(false)
+        {
+        }
+
+        std::deque<std::function<void()>> tasks; /* queued tasks */
+        bool busy; /* is a task running? */
+        std::thread thread; /* worker */
+    };
+
+  public:
+    ThreadPool(size_t threads, size_t queueSize)
+        : lanes(threads != 0 ? threads : 1)
+        , queueSize(queueSize != 0 ? queueSize : 1)
+        , next(0)
+        , stopping(false)
+    {
+        for (size_t i = 0; i < lanes.size(); i++) {
+            lanes[i].thread = std::thread(&ThreadPool::work, this, i);
+        }
+    }
+
+    /*
+     * finish all queued tasks, then stop the workers
+     */
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (auto lane = lanes.begin(); lane != lanes.end(); lane++) {
+            lane->thread.join();
+        }
+    }
+
+    /*
+     * number of workers
+     */
+    size_t size()
+    {
+        return lanes.size();
+    }
+
+    /*
+     * run a task after all tasks previously submitted to the same lane
+     */
+    void submit(size_t lane, std::function<void()> task)
+    {
+        Lane& l = lanes[lane % lanes.size()];
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&] { return l.tasks.size() < queueSize; });
+            l.tasks.push_back(std::move(task));
+        }
+        queued.notify_all();
+    }
+
+    /*
+     * run an independent task on any worker
+     */
+    void submit(std::function<void()> task)
+    {
+        submit(next++, std::move(task));
+    }
+
+    /*
+     * wait until all submitted tasks have finished
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        done.wait(lock, [&] {
+            for (auto lane = lanes.begin(); lane != lanes.end(); lane++) {
+                if (lane->busy || !lane->tasks.empty()) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+  private:
+    /*
+     * worker thread: run the tasks of a lane until stopped
+     */
+    void work(size_t lane)
+    {
+        Lane& l = lanes[lane];
+        std::function<void()> task;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                l.busy = false;
+                done.notify_all();
+                queued.wait(lock, [&] { return stopping || !l.tasks.empty(); });
+                if (l.tasks.empty()) {
+                    return;
+                }
+                task = std::move(l.tasks.front());
+                l.tasks.pop_front();
+                l.busy = true;
+            }
+            done.notify_all();
+
+            try {
+                task();
+            }
+            catch (...) {
+                /* tasks report their own errors */
+            }
+        }
+    }
+
+    std::vector<Lane> lanes; /* one queue per worker */
+    size_t queueSize; /* maximum number of queued tasks per lane */
+    size_t next; /* lane for the next independent task */
+    bool stopping; /* shutting down? */
+    std::mutex mutex; /* protects the queues */
+    std::condition_variable queued; /* a task was queued */
+    std::condition_variable done; /* a task was dequeued or has finished */
+};
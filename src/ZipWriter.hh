@@ -0,0 +1,513 @@
+#pragma once
+
+#include <zlib.h>
+
+#include "ThreadPool.hh"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define A_ZIPCHUNK  ((size_t) 1024 * 1024)
+#define A_ZIPDICT   ((size_t) 32768)
+#define A_ZIP64SIZE ((uint64_t) 0xff000000) /* leaves room for deflate overhead */
+#define A_ZIPMAX32  ((uint64_t) 0xffffffff)
+
+/*
+ * Writer for zip archives that compresses on a pool of worker threads. The
+ * data of an entry is split into chunks that are deflated independently,
+ * each primed with the end of the previous chunk as dictionary, and ended
+ * with a sync flush so that the compressed chunks can be concatenated. The
+ * CRCs of the chunks are combined in order. Compressed chunks are written
+ * in order, by the thread that adds the data; the number of chunks in
+ * progress is limited, which bounds the memory used. Local headers and
+ * data descriptors are queued with the chunks, so that the chunks of
+ * several small files can be compressed at the same time.
+ *
+ * Entries have a data descriptor, and zip64 fields if their size requires
+ * it. The central directory is written by close().
+ */
+class ZipWriter
+{
+    class Chunk
+    {
+      public:
+        std::vector<char> in; /* uncompressed data */
+        std::vector<char> out; /* compressed data */
+        uLong crc; /* CRC32 of the uncompressed data */
+        bool ok; /* compressed successfully? */
+        std::promise<void> ready; /* set when processed */
+    };
+
+    /*
+     * what to write next: a local header, a chunk of data, or the end of a
+     * file
+     */
+    class Step
+    {
+      public:
+        enum
+        {
+            HEADER,
+            DATA,
+            END
+        };
+
+        int kind; /* HEADER, DATA or END */
+        size_t entry; /* index of the entry */
+        std::shared_ptr<Chunk> chunk; /* data, or NULL */
+    };
+
+    class Entry
+    {
+      public:
+        std::string name; /* name, with a trailing slash for directories */
+        time_t modified; /* modification time */
+        bool dir; /* directory? */
+        bool deflate; /* compressed? */
+        bool zip64; /* zip64 data descriptor? */
+        uint64_t offset; /* offset of the local header */
+        uint64_t size; /* uncompressed size */
+        uint64_t csize; /* compressed size */
+        uLong crc; /* CRC32 of the data */
+    };
+
+  public:
+    ZipWriter(std::function<int(const void*, size_t)> output, size_t threads, size_t budget)
+        : output(output)
+        , pool(threads, 1)
+        , budget(budget != 0 ? budget : 1)
+        , offset(0)
+        , status(0)
+        , chunks(0)
+    {
+    }
+
+    /*
+     * wait for the workers to finish
+     */
+    ~ZipWriter()
+    {
+        pool.wait();
+    }
+
+    /*
+     * add a directory
+     */
+    int addDirectory(const std::string& name, time_t modified)
+    {
+        Entry entry;
+
+        entry.name = name + "/";
+        entry.modified = modified;
+        entry.dir = true;
+        entry.deflate = false;
+        entry.zip64 = false;
+        entry.offset = 0;
+        entry.size = entry.csize = 0;
+        entry.crc = crc32(0, Z_NULL, 0);
+        entries.push_back(entry);
+        queue(Step::HEADER, NULL);
+        return status;
+    }
+
+    /*
+     * start a file of the expected size, its data follows with write()
+     */
+    int addFile(const std::string& name, time_t modified, uint64_t size, bool deflate)
+    {
+        Entry entry;
+
+        entry.name = name;
+        entry.modified = modified;
+        entry.dir = false;
+        entry.deflate = deflate;
+        entry.zip64 = (size >= A_ZIP64SIZE);
+        entry.offset = 0; /* set when the local header is written */
+        entry.size = entry.csize = 0;
+        entry.crc = crc32(0, Z_NULL, 0);
+        entries.push_back(entry);
+        previous = NULL;
+        queue(Step::HEADER, NULL);
+        return status;
+    }
+
+    /*
+     * add data to the current file
+     */
+    int write(const void* buf, size_t len)
+    {
+        size_t n;
+
+        while (len != 0 && status == 0) {
+            if (current == NULL) {
+                current = std::make_shared<Chunk>();
+                current->in.reserve(A_ZIPCHUNK);
+            }
+            n = std::min(len, A_ZIPCHUNK - current->in.size());
+            current->in.insert(current->in.end(), (const char*) buf, (const char*) buf + n);
+            buf = (const char*) buf + n;
+            len -= n;
+            if (current->in.size() == A_ZIPCHUNK) {
+                submit();
+            }
+        }
+        return status;
+    }
+
+    /*
+     * Finish the current file. Its data descriptor is written once all of
+     * its chunks are, so the next file can be added in the meantime.
+     */
+    int finishFile()
+    {
+        if (current != NULL) {
+            submit();
+        }
+        previous = NULL;
+        queue(Step::END, NULL);
+        return status;
+    }
+
+    /*
+     * write the central directory
+     */
+    int close()
+    {
+        std::string dir, extra;
+        uint64_t start, size;
+        bool zip64;
+
+        flush(0);
+        if (status != 0) {
+            return status;
+        }
+        start = offset;
+        for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+            extra.clear();
+            if (entry->size >= A_ZIPMAX32 || entry->csize >= A_ZIPMAX32 || entry->offset >= A_ZIPMAX32) {
+                le16(extra, 0x0001);
+                le16(extra,
+                     (uint16_t) (8 * ((entry->size >= A_ZIPMAX32) + (entry->csize >= A_ZIPMAX32) +
+                                      (entry->offset >= A_ZIPMAX32))));
+                if (entry->size >= A_ZIPMAX32) {
+                    le64(extra, entry->size);
+                }
+                if (entry->csize >= A_ZIPMAX32) {
+                    le64(extra, entry->csize);
+                }
+                if (entry->offset >= A_ZIPMAX32) {
+                    le64(extra, entry->offset);
+                }
+            }
+            timestamp(extra, entry->modified);
+
+            le32(dir, 0x02014b50);
+            le16(dir, (uint16_t) ((3 << 8) | 45)); /* made by: UNIX, zip 4.5 */
+            common(dir, *entry, (entry->zip64 || extra.length() > 9) ? 45 : 20);
+            le32(dir, (uint32_t) entry->crc);
+            le32(dir, (uint32_t) std::min(entry->csize, A_ZIPMAX32));
+            le32(dir, (uint32_t) std::min(entry->size, A_ZIPMAX32));
+            le16(dir, (uint16_t) entry->name.length());
+            le16(dir, (uint16_t) extra.length());
+            le16(dir, 0); /* comment */
+            le16(dir, 0); /* disk */
+            le16(dir, 0); /* internal attributes */
+            le32(dir, entry->dir ? ((040750u << 16) | 0x10) : (0100600u << 16));
+            le32(dir, (uint32_t) std::min(entry->offset, A_ZIPMAX32));
+            dir += entry->name;
+            dir += extra;
+        }
+
+        size = dir.length();
+        zip64 = (entries.size() >= 0xffff || start >= A_ZIPMAX32 || size >= A_ZIPMAX32);
+        if (zip64) {
+            /*
+             * zip64 end of central directory record and locator
+             */
+            le32(dir, 0x06064b50);
+            le64(dir, 44); /* size of the rest of the record */
+            le16(dir, (uint16_t) ((3 << 8) | 45));
+            le16(dir, 45);
+            le32(dir, 0); /* disk */
+            le32(dir, 0); /* disk with the central directory */
+            le64(dir, entries.size());
+            le64(dir, entries.size());
+            le64(dir, size);
+            le64(dir, start);
+            le32(dir, 0x07064b50);
+            le32(dir, 0);
+            le64(dir, start + size);
+            le32(dir, 1); /* number of disks */
+        }
+        le32(dir, 0x06054b50);
+        le16(dir, 0);
+        le16(dir, 0);
+        le16(dir, (uint16_t) std::min(entries.size(), (size_t) 0xffff));
+        le16(dir, (uint16_t) std::min(entries.size(), (size_t) 0xffff));
+        le32(dir, (uint32_t) std::min(size, A_ZIPMAX32));
+        le32(dir, (uint32_t) std::min(start, A_ZIPMAX32));
+        le16(dir, 0); /* comment */
+        return put(dir.data(), dir.length());
+    }
+
+  private:
+    /*
+     * hand the current chunk to a worker
+     */
+    void submit()
+    {
+        std::shared_ptr<Chunk> chunk, prev;
+        bool deflate;
+
+        chunk = current;
+        prev = previous;
+        deflate = entries.back().deflate;
+        current = NULL;
+        previous = chunk;
+        pool.submit([chunk, prev, deflate] { process(*chunk, (prev != NULL) ? &prev->in : NULL, deflate); });
+        queue(Step::DATA, chunk);
+    }
+
+    /*
+     * queue a step of the current entry, and write what is ready within
+     * the budget
+     */
+    void queue(int kind, std::shared_ptr<Chunk> chunk)
+    {
+        Step step;
+
+        step.kind = kind;
+        step.entry = entries.size() - 1;
+        step.chunk = chunk;
+        pending.push_back(step);
+        if (chunk != NULL) {
+            chunks++;
+        }
+        flush(budget);
+    }
+
+    /*
+     * Write queued steps in order, until at most the given number of
+     * chunks is left in progress. Headers and data descriptors that
+     * precede the first chunk in progress are written as well.
+     */
+    void flush(size_t left)
+    {
+        while (!pending.empty() && (chunks > left || pending.front().chunk == NULL)) {
+            Step step = pending.front();
+            Entry& entry = entries[step.entry];
+
+            pending.pop_front();
+            if (step.kind == Step::HEADER) {
+                entry.offset = offset;
+                if (status == 0) {
+                    status = localHeader(entry);
+                }
+                continue;
+            }
+            if (step.kind == Step::END) {
+                if (status == 0) {
+                    status = end(entry);
+                }
+                continue;
+            }
+
+            chunks--;
+            step.chunk->ready.get_future().wait();
+            if (status != 0) {
+                continue;
+            }
+            if (!step.chunk->ok) {
+                status = -1;
+                continue;
+            }
+
+            entry.crc = crc32_combine(entry.crc, step.chunk->crc, (z_off_t) step.chunk->in.size());
+            entry.size += step.chunk->in.size();
+            if (entry.deflate) {
+                status = put(step.chunk->out.data(), step.chunk->out.size());
+                entry.csize += step.chunk->out.size();
+            }
+            else {
+                status = put(step.chunk->in.data(), step.chunk->in.size());
+                entry.csize += step.chunk->in.size();
+            }
+        }
+    }
+
+    /*
+     * end a file after its last chunk: the final deflate block and the
+     * data descriptor
+     */
+    int end(Entry& entry)
+    {
+        std::string desc;
+
+        if (entry.deflate) {
+            /*
+             * final empty block, after the last sync flush
+             */
+            status = put("\003\000", 2);
+            entry.csize += 2;
+        }
+        if (!entry.zip64 && (entry.size >= A_ZIPMAX32 || entry.csize >= A_ZIPMAX32)) {
+            return (status = -1); /* larger than announced */
+        }
+
+        le32(desc, 0x08074b50);
+        le32(desc, (uint32_t) entry.crc);
+        if (entry.zip64) {
+            le64(desc, entry.csize);
+            le64(desc, entry.size);
+        }
+        else {
+            le32(desc, (uint32_t) entry.csize);
+            le32(desc, (uint32_t) entry.size);
+        }
+        return (status == 0) ? put(desc.data(), desc.length()) : status;
+    }
+
+    /*
+     * compute the CRC of a chunk and compress it
+     */
+    static void process(Chunk& chunk, const std::vector<char>* dict, bool deflate)
+    {
+        z_stream z;
+        size_t len;
+
+        chunk.crc = crc32(0, (const Bytef*) chunk.in.data(), (uInt) chunk.in.size());
+        chunk.ok = true;
+        if (deflate) {
+            memset(&z, '\0', sizeof(z));
+            chunk.ok = (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+            if (chunk.ok) {
+                if (dict != NULL) {
+                    len = std::min(dict->size(), A_ZIPDICT);
+                    deflateSetDictionary(&z, (const Bytef*) dict->data() + dict->size() - len, (uInt) len);
+                }
+                chunk.out.resize(deflateBound(&z, (uLong) chunk.in.size()) + 16);
+                z.next_in = (Bytef*) chunk.in.data();
+                z.avail_in = (uInt) chunk.in.size();
+                z.next_out = (Bytef*) chunk.out.data();
+                z.avail_out = (uInt) chunk.out.size();
+                chunk.ok = (::deflate(&z, Z_SYNC_FLUSH) == Z_OK && z.avail_in == 0 && z.avail_out != 0);
+                chunk.out.resize(chunk.out.size() - z.avail_out);
+                deflateEnd(&z);
+            }
+        }
+        chunk.ready.set_value();
+    }
+
+    /*
+     * write a local file header
+     */
+    int localHeader(const Entry& entry)
+    {
+        std::string header, extra;
+
+        if (entry.zip64) {
+            le16(extra, 0x0001);
+            le16(extra, 16);
+            le64(extra, 0);
+            le64(extra, 0);
+        }
+        timestamp(extra, entry.modified);
+
+        le32(header, 0x04034b50);
+        common(header, entry, entry.zip64 ? 45 : 20);
+        le32(header, 0); /* CRC and sizes follow in the data descriptor */
+        le32(header, entry.zip64 ? 0xffffffff : 0);
+        le32(header, entry.zip64 ? 0xffffffff : 0);
+        le16(header, (uint16_t) entry.name.length());
+        le16(header, (uint16_t) extra.length());
+        header += entry.name;
+        header += extra;
+        return put(header.data(), header.length());
+    }
+
+    /*
+     * header fields shared by local and central headers: version needed,
+     * flags, method, time and date
+     */
+    static void common(std::string& header, const Entry& entry, uint16_t version)
+    {
+        struct tm tm;
+        time_t t;
+
+        t = entry.modified;
+        localtime_r(&t, &tm);
+        if (tm.tm_year < 80) {
+            tm.tm_year = 80;
+            tm.tm_mon = 0;
+            tm.tm_mday = 1;
+            tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+        }
+        le16(header, version);
+        le16(header, (uint16_t) ((1 << 11) | (entry.dir ? 0 : (1 << 3)))); /* UTF-8, data descriptor */
+        le16(header, entry.deflate ? 8 : 0);
+        le16(header, (uint16_t) ((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2)));
+        le16(header, (uint16_t) (((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday));
+    }
+
+    /*
+     * extended timestamp extra field, with the modification time
+     */
+    static void timestamp(std::string& extra, time_t modified)
+    {
+        le16(extra, 0x5455);
+        le16(extra, 5);
+        extra += '\001';
+        le32(extra, (uint32_t) modified);
+    }
+
+    /*
+     * write to the archive
+     */
+    int put(const void* buf, size_t len)
+    {
+        int result;
+
+        result = output(buf, len);
+        if (result < 0) {
+            return result;
+        }
+        offset += len;
+        return 0;
+    }
+
+    static void le16(std::string& str, uint16_t value)
+    {
+        str += (char) (value & 0xff);
+        str += (char) (value >> 8);
+    }
+
+    static void le32(std::string& str, uint32_t value)
+    {
+        le16(str, (uint16_t) (value & 0xffff));
+        le16(str, (uint16_t) (value >> 16));
+    }
+
+    static void le64(std::string& str, uint64_t value)
+    {
+        le32(str, (uint32_t) (value & 0xffffffff));
+        le32(str, (uint32_t) (value >> 32));
+    }
+
+    std::function<int(const void*, size_t)> output; /* writes to the archive */
+    ThreadPool pool; /* compression workers */
+    size_t budget; /* maximum number of chunks in progress */
+    uint64_t offset; /* bytes written */
+    int status; /* first error */
+    std::vector<Entry> entries; /* entries written */
+    std::shared_ptr<Chunk> current; /* chunk being filled */
+    std::shared_ptr<Chunk> previous; /* previous chunk of the current file */
+    std::deque<Step> pending; /* steps not yet written, in order */
+    size_t chunks; /* number of chunks in pending */
+};
@@ -8,9 +8,18 @@
 
 #include "irods_includes.hh"
 #include "Archive.hh"
+#include "ArchiveJob.hh"
+#include "Options.hh"
 
 #include "rsGenQuery.hpp"
 
+#include <unistd.h>
+#include <map>
+#include <set>
+#include <vector>
+
+#define A_SOURCEBATCH 64 /* DataObj names per catalog query */
+
 /*
  * obtain ID of a collection, or a negative error status
  */
@@ -246,20 +255,139 @@ static json_t* aclColl(rsComm_t* rsComm, long long id)
 }
 
 /*
- * pass on metadata from DataObjs in a given location to the archive
+ * Choice of the replica to read for each DataObj: one on a preferred
+ * resource, in the order in which they are listed, else one on a resource
+ * hosted by this server, else any good replica.
+ */
+class ReplicaChoice
+{
+  public:
+    ReplicaChoice(rsComm_t* rsComm, std::vector<std::string> preferred)
+        : preferred(preferred)
+    {
+        genQueryInp_t genQueryInp;
+        genQueryOut_t* genQueryOut;
+        sqlResult_t *names, *locs;
+        char host[MAX_NAME_LEN];
+        std::string loc, shortHost;
+
+        /*
+         * find the resources on this server
+         */
+        if (gethostname(host, sizeof(host)) != 0) {
+            return;
+        }
+        host[sizeof(host) - 1] = '\0';
+        shortHost = std::string(host, strcspn(host, "."));
+        memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
+        addInxIval(&genQueryInp.selectInp, COL_R_RESC_NAME, 1);
+        addInxIval(&genQueryInp.selectInp, COL_R_LOC, 1);
+        genQueryInp.maxRows = MAX_SQL_ROWS;
+        genQueryOut = NULL;
+
+        while (rsGenQuery(rsComm, &genQueryInp, &genQueryOut) == 0 && genQueryOut->rowCnt != 0) {
+            names = getSqlResultByInx(genQueryOut, COL_R_RESC_NAME);
+            locs = getSqlResultByInx(genQueryOut, COL_R_LOC);
+
+            for (int i = 0; i < genQueryOut->rowCnt; i++) {
+                loc = &locs->value[locs->len * i];
+                if (loc.compare(host) == 0 || loc.substr(0, loc.find('.')) == shortHost) {
+                    local.insert(&names->value[names->len * i]);
+                }
+            }
+
+            genQueryInp.continueInx = genQueryOut->continueInx;
+            if (genQueryInp.continueInx == 0) {
+                break;
+            }
+            freeGenQueryOut(&genQueryOut);
+        }
+
+        clearGenQueryInp(&genQueryInp);
+        freeGenQueryOut(&genQueryOut);
+    }
+
+    /*
+     * rank a replica by its resource hierarchy, lower is better
+     */
+    size_t rank(const std::string& hier)
+    {
+        size_t rank, start, end, i;
+
+        rank = preferred.size() + 1;
+        for (start = 0; start <= hier.length(); start = end + 1) {
+            end = hier.find(';', start);
+            if (end == std::string::npos) {
+                end = hier.length();
+            }
+            std::string resc = hier.substr(start, end - start);
+            for (i = 0; i < preferred.size() && i < rank; i++) {
+                if (preferred[i] == resc) {
+                    rank = i;
+                }
+            }
+            if (end == hier.length() && rank > preferred.size() && local.count(resc) != 0) {
+                rank = preferred.size(); /* leaf resource on this server */
+            }
+        }
+        return rank;
+    }
+
+  private:
+    std::vector<std::string> preferred; /* preferred resources */
+    std::set<std::string> local; /* resources on this server */
+};
+
+/*
+ * a good replica of a DataObj
+ */
+struct Replica
+{
+    long long id; /* DataObj ID */
+    std::string name; /* name relative to the archived collection */
+    size_t size; /* size of the replica */
+    time_t created; /* creation time */
+    time_t modified; /* modification time */
+    std::string owner; /* owner name */
+    std::string zone; /* owner zone */
+    std::string checksum; /* checksum, if any */
+    std::string hier; /* resource hierarchy */
+    std::string path; /* physical path */
+    size_t rank; /* preference for reading this replica */
+};
+
+/*
+ * Pass on metadata from DataObjs in a given location to the archive, and
+ * return the number of DataObjs found. Names are relative to the parent
+ * collection if given, and the DataObjs can be restricted to those matching
+ * a condition on their names.
  */
-static void dirDataObj(Archive* a, rsComm_t* rsComm, std::string coll, long long collId)
+static size_t dirDataObj(Archive* a,
+                         rsComm_t* rsComm,
+                         ReplicaChoice& choice,
+                         std::string coll,
+                         long long collId,
+                         const char* parent = NULL,
+                         const char* nameCond = NULL)
 {
     char collQCond[MAX_NAME_LEN];
     genQueryInp_t genQueryInp;
     genQueryOut_t* genQueryOut;
-    sqlResult_t *names, *ids, *sizes, *owners, *zones, *ctimes, *mtimes, *checksums;
-    long long dataId;
+    sqlResult_t *names, *ids, *sizes, *owners, *zones, *ctimes, *mtimes, *checksums, *hiers, *paths;
+    Replica replica;
+    std::vector<Replica> dataObjs;
+    std::map<long long, size_t> found;
 
+    /*
+     * every good replica is returned, only the best one is used
+     */
     memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
     snprintf(collQCond, MAX_NAME_LEN, "='%lld'", collId);
     addInxVal(&genQueryInp.sqlCondInp, COL_D_COLL_ID, collQCond);
     addInxVal(&genQueryInp.sqlCondInp, COL_D_REPL_STATUS, "='1'");
+    if (nameCond != NULL) {
+        addInxVal(&genQueryInp.sqlCondInp, COL_DATA_NAME, nameCond);
+    }
     addInxIval(&genQueryInp.selectInp, COL_DATA_NAME, 1);
     addInxIval(&genQueryInp.selectInp, COL_D_DATA_ID, 1);
     addInxIval(&genQueryInp.selectInp, COL_DATA_SIZE, 1);
@@ -268,6 +396,8 @@ static void dirDataObj(Archive* a, rsComm_t* rsComm, std::string coll, long long
     addInxIval(&genQueryInp.selectInp, COL_D_CREATE_TIME, 1);
     addInxIval(&genQueryInp.selectInp, COL_D_MODIFY_TIME, 1);
     addInxIval(&genQueryInp.selectInp, COL_D_DATA_CHECKSUM, 1);
+    addInxIval(&genQueryInp.selectInp, COL_D_RESC_HIER, 1);
+    addInxIval(&genQueryInp.selectInp, COL_D_DATA_PATH, 1);
     genQueryInp.maxRows = MAX_SQL_ROWS;
     genQueryOut = NULL;
 
@@ -280,18 +410,30 @@ static void dirDataObj(Archive* a, rsComm_t* rsComm, std::string coll, long long
         ctimes = getSqlResultByInx(genQueryOut, COL_D_CREATE_TIME);
         mtimes = getSqlResultByInx(genQueryOut, COL_D_MODIFY_TIME);
         checksums = getSqlResultByInx(genQueryOut, COL_D_DATA_CHECKSUM);
+        hiers = getSqlResultByInx(genQueryOut, COL_D_RESC_HIER);
+        paths = getSqlResultByInx(genQueryOut, COL_D_DATA_PATH);
 
         for (int i = 0; i < genQueryOut->rowCnt; i++) {
-            dataId = strtoll(&ids->value[ids->len * i], NULL, 10);
-            a->addDataObj(coll + &names->value[names->len * i],
-                          (size_t) strtoll(&sizes->value[sizes->len * i], NULL, 10),
-                          strtoll(&ctimes->value[ctimes->len * i], NULL, 10),
-                          strtoll(&mtimes->value[mtimes->len * i], NULL, 10),
-                          &owners->value[owners->len * i],
-                          &zones->value[zones->len * i],
-                          &checksums->value[checksums->len * i],
-                          attrDataObj(rsComm, dataId),
-                          aclDataObj(rsComm, dataId));
+            replica.id = strtoll(&ids->value[ids->len * i], NULL, 10);
+            replica.name = coll + &names->value[names->len * i];
+            replica.size = (size_t) strtoll(&sizes->value[sizes->len * i], NULL, 10);
+            replica.created = strtoll(&ctimes->value[ctimes->len * i], NULL, 10);
+            replica.modified = strtoll(&mtimes->value[mtimes->len * i], NULL, 10);
+            replica.owner = &owners->value[owners->len * i];
+            replica.zone = &zones->value[zones->len * i];
+            replica.checksum = &checksums->value[checksums->len * i];
+            replica.hier = &hiers->value[hiers->len * i];
+            replica.path = &paths->value[paths->len * i];
+            replica.rank = choice.rank(replica.hier);
+
+            auto dataObj = found.find(replica.id);
+            if (dataObj == found.end()) {
+                found[replica.id] = dataObjs.size();
+                dataObjs.push_back(replica);
+            }
+            else if (replica.rank < dataObjs[dataObj->second].rank) {
+                dataObjs[dataObj->second] = replica;
+            }
         }
 
         genQueryInp.continueInx = genQueryOut->continueInx;
@@ -301,14 +443,36 @@ static void dirDataObj(Archive* a, rsComm_t* rsComm, std::string coll, long long
         freeGenQueryOut(&genQueryOut);
     }
 
+    clearGenQueryInp(&genQueryInp);
     freeGenQueryOut(&genQueryOut);
-    freeGenQueryOut(&genQueryOut);
+
+    for (auto dataObj = dataObjs.begin(); dataObj != dataObjs.end(); dataObj++) {
+        a->addDataObj(dataObj->name,
+                      dataObj->size,
+                      dataObj->created,
+                      dataObj->modified,
+                      dataObj->owner,
+                      dataObj->zone,
+                      dataObj->checksum,
+                      attrDataObj(rsComm, dataObj->id),
+                      aclDataObj(rsComm, dataObj->id),
+                      dataObj->hier.c_str(),
+                      dataObj->path.c_str(),
+                      parent);
+    }
+    return dataObjs.size();
 }
 
 /*
- * recursively pass on metadata for collections to the archive
+ * Recursively pass on metadata for collections to the archive. Names are
+ * relative to coll, which is the parent collection if given.
  */
-static void dirColl(Archive* a, rsComm_t* rsComm, std::string& coll, std::string& path)
+static void dirColl(Archive* a,
+                    rsComm_t* rsComm,
+                    ReplicaChoice& choice,
+                    std::string& coll,
+                    std::string& path,
+                    const char* parent = NULL)
 {
     char collQCond[MAX_NAME_LEN];
     genQueryInp_t genQueryInp;
@@ -347,7 +511,8 @@ static void dirColl(Archive* a, rsComm_t* rsComm, std::string& coll, std::string
                        &owners->value[owners->len * i],
                        &zones->value[zones->len * i],
                        attrColl(rsComm, id),
-                       aclColl(rsComm, id));
+                       aclColl(rsComm, id),
+                       parent);
 
             /*
              * maintain a list of collections to recursively query
@@ -370,9 +535,134 @@ static void dirColl(Archive* a, rsComm_t* rsComm, std::string& coll, std::string
      * that the maximum number of open queries is not exceeded.
      */
     for (auto dir = dirs.begin(); dir != dirs.end(); dir++) {
-        dirColl(a, rsComm, coll, dir->first);
-        dirDataObj(a, rsComm, dir->first.substr(coll.length() + 1) + "/", dir->second);
+        dirColl(a, rsComm, choice, coll, dir->first, parent);
+        dirDataObj(a, rsComm, choice, dir->first.substr(coll.length() + 1) + "/", dir->second, parent);
+    }
+}
+
+/*
+ * Check a list of sources for a single archive: every source must be an
+ * existing collection or DataObj, and their names must differ. Return 0 or
+ * an error status.
+ */
+static int checkSources(rsComm_t* rsComm, std::vector<std::string>& sources, std::vector<bool>& isColl)
+{
+    dataObjInp_t dataObjInp;
+    rodsObjStat_t* objStat;
+    std::set<std::string> names;
+    std::string name;
+    int status;
+
+    for (auto source = sources.begin(); source != sources.end(); source++) {
+        while (source->length() > 1 && source->back() == '/') {
+            source->pop_back();
+        }
+        name = source->substr(source->rfind('/') + 1);
+        if (source->find('/') != 0 || name.empty() || names.count(name) != 0) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: cannot archive %s with the other sources", source->c_str());
+            return SYS_INVALID_INPUT_PARAM;
+        }
+        names.insert(name);
+
+        memset(&dataObjInp, '\0', sizeof(dataObjInp_t));
+        rstrcpy(dataObjInp.objPath, source->c_str(), MAX_NAME_LEN);
+        objStat = NULL;
+        status = rsObjStat(rsComm, &dataObjInp, &objStat);
+        if (status < 0) {
+            rodsLog(LOG_ERROR, "msiArchiveCreate: cannot find %s", source->c_str());
+            return status;
+        }
+        isColl.push_back(objStat->objType == COLL_OBJ_T);
+        freeRodsObjStat(objStat);
     }
+    return 0;
+}
+
+/*
+ * Pass on metadata for a list of collections and DataObjs to the archive.
+ * Each source is archived under its own name, relative to its parent
+ * collection. DataObjs with the same parent are harvested together.
+ */
+static int dirSources(Archive* a,
+                      rsComm_t* rsComm,
+                      ReplicaChoice& choice,
+                      std::vector<std::string>& sources,
+                      std::vector<bool>& isColl)
+{
+    char collQCond[MAX_NAME_LEN];
+    genQueryInp_t genQueryInp;
+    genQueryOut_t* genQueryOut;
+    std::map<std::string, std::vector<std::string>> dataObjs;
+    std::string parent, name, nameCond;
+    long long id;
+    size_t i, n, found;
+    int status;
+
+    for (i = 0; i < sources.size(); i++) {
+        parent = sources[i].substr(0, sources[i].rfind('/'));
+        name = sources[i].substr(parent.length() + 1);
+        if (!isColl[i]) {
+            dataObjs[parent].push_back(name);
+            continue;
+        }
+
+        /*
+         * the collection itself, then its contents
+         */
+        memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
+        snprintf(collQCond, MAX_NAME_LEN, "='%s'", sources[i].c_str());
+        addInxVal(&genQueryInp.sqlCondInp, COL_COLL_NAME, collQCond);
+        addInxIval(&genQueryInp.selectInp, COL_COLL_ID, 1);
+        addInxIval(&genQueryInp.selectInp, COL_COLL_OWNER_NAME, 1);
+        addInxIval(&genQueryInp.selectInp, COL_COLL_OWNER_ZONE, 1);
+        addInxIval(&genQueryInp.selectInp, COL_COLL_CREATE_TIME, 1);
+        addInxIval(&genQueryInp.selectInp, COL_COLL_MODIFY_TIME, 1);
+        genQueryInp.maxRows = 1;
+        genQueryOut = NULL;
+        status = rsGenQuery(rsComm, &genQueryInp, &genQueryOut);
+        clearGenQueryInp(&genQueryInp);
+        if (status < 0 || genQueryOut->rowCnt != 1) {
+            freeGenQueryOut(&genQueryOut);
+            return CAT_UNKNOWN_COLLECTION;
+        }
+        id = strtoll(getSqlResultByInx(genQueryOut, COL_COLL_ID)->value, NULL, 10);
+        a->addColl(name,
+                   strtoll(getSqlResultByInx(genQueryOut, COL_COLL_CREATE_TIME)->value, NULL, 10),
+                   strtoll(getSqlResultByInx(genQueryOut, COL_COLL_MODIFY_TIME)->value, NULL, 10),
+                   getSqlResultByInx(genQueryOut, COL_COLL_OWNER_NAME)->value,
+                   getSqlResultByInx(genQueryOut, COL_COLL_OWNER_ZONE)->value,
+                   attrColl(rsComm, id),
+                   aclColl(rsComm, id),
+                   parent.c_str());
+        freeGenQueryOut(&genQueryOut);
+
+        dirColl(a, rsComm, choice, parent, sources[i], parent.c_str());
+        dirDataObj(a, rsComm, choice, name + "/", id, parent.c_str());
+    }
+
+    /*
+     * DataObjs, a batch of names per query
+     */
+    for (auto dir = dataObjs.begin(); dir != dataObjs.end(); dir++) {
+        parent = dir->first;
+        id = collID(rsComm, parent);
+        if (id < 0) {
+            return (int) id;
+        }
+        for (i = 0; i < dir->second.size(); i += A_SOURCEBATCH) {
+            nameCond = "in (";
+            for (n = i; n < dir->second.size() && n < i + A_SOURCEBATCH; n++) {
+                nameCond += ((n != i) ? ", '" : "'") + dir->second[n] + "'";
+            }
+            nameCond += ")";
+            found = dirDataObj(a, rsComm, choice, "", id, parent.c_str(), nameCond.c_str());
+            if (found != n - i) {
+                rodsLog(LOG_ERROR, "msiArchiveCreate: DataObjs in %s without a good replica", parent.c_str());
+                return CAT_UNKNOWN_FILE;
+            }
+        }
+    }
+    return 0;
 }
 
 extern "C" {
@@ -402,40 +692,176 @@ int msiArchiveCreate(msParam_t* archiveIn,
     }
     std::string archive = archiveStr;
     std::string collection = collectionStr;
-    const char* resource = NULL;
-    if (resourceIn->type != NULL && strcmp(resourceIn->type, STR_MS_T) == 0) {
-        resource = parseMspForStr(resourceIn);
+
+    /*
+     * The second parameter is either a collection, or a JSON array of
+     * collections and DataObjs to archive together. Each of those is
+     * archived under its own name, and the index records where each item
+     * came from.
+     */
+    std::vector<std::string> sources;
+    std::vector<bool> isColl;
+    if (collectionStr[0] == '[') {
+        json_t *json, *source;
+        size_t i;
+
+        json = json_loads(collectionStr, 0, NULL);
+        json_array_foreach(json, i, source)
+        {
+            if (!json_is_string(source)) {
+                json_decref(json);
+                return SYS_INVALID_INPUT_PARAM;
+            }
+            sources.push_back(json_string_value(source));
+        }
+        json_decref(json);
+        if (sources.empty()) {
+            return SYS_INVALID_INPUT_PARAM;
+        }
+    }
+
+    /*
+     * The third parameter is either the name of the resource, or a list of
+     * options:
+     *   resource:         resource to create the archive on
+     *   sidecar:          also write the index as a separate DataObj
+     *   sidecarResource:  resource to create the sidecar index on
+     *   indexReserve:     bytes to reserve for INDEX.json, for later appends
+     *   append:           add new and modified items to an existing
+     *                     uncompressed tar archive instead of creating it
+     *   indexVersion:     1 to include attributes and ACLs with every item
+     *                     in INDEX.json, for older readers; appending
+     *                     keeps the version of the archive by default
+     *   indexFormat:      "cbor" to store the index in binary form as
+     *                     INDEX.cbor, which loads faster
+     *   order:            "location" to read DataObjs in the order of the
+     *                     resource and physical path of their replicas,
+     *                     "size" to group them by size class
+     *   replicaResources: comma separated list of resources to prefer
+     *                     when reading DataObjs with multiple replicas
+     *   zipCompression:   "deflate" to compress all DataObjs in a zip
+     *                     archive, "store" to compress none; by default,
+     *                     DataObjs that are already compressed are stored
+     *   zipThreads:       threads that compress DataObjs in a zip archive,
+     *                     default 4
+     *   job:              create the archive in the background, see
+     *                     msiArchiveJobStatus
+     */
+    Options options(resourceIn, "resource");
+    const char* resource = options.get("resource");
+    const char* worker = options.get("jobWorker"); /* ID of the job, set by its delayed rule only */
+    ArchiveJob job(rei->rsComm, archive, "create");
+
+    if (sources.empty()) {
+        id = collID(rei->rsComm, collection);
+    }
+    else if (options.flag("append")) {
+        rodsLog(LOG_ERROR, "msiArchiveCreate: can only append to an archive of a single collection");
+        id = SYS_INVALID_INPUT_PARAM;
+    }
+    else {
+        id = checkSources(rei->rsComm, sources, isColl);
+    }
+    if (id >= 0 && options.flag("job")) {
+        /*
+         * let a delayed rule do the work
+         */
+        if (worker != NULL) {
+            fillIntInMsParam(statusOut, SYS_INVALID_INPUT_PARAM);
+            return SYS_INVALID_INPUT_PARAM;
+        }
+        status = job.submit(rei,
+                            "msiArchiveCreate(" + ArchiveJob::quote(archive) + ", " + ArchiveJob::quote(collection) +
+                                ", *options, *status)",
+                            options.serialize("job"));
+        fillIntInMsParam(statusOut, status);
+        return status;
+    }
+    if (id >= 0 && worker != NULL) {
+        id = job.start(worker);
     }
 
-    id = collID(rei->rsComm, collection);
     if (id < 0) {
         /*
-         * no such collection
+         * no such collection, or canceled job
          */
         status = (int) id;
     }
     else {
         /*
-         * create archive
+         * create archive, or open it for appending
          */
-        Archive* a = Archive::create(rei->rsComm, archive, collection, resource);
+        Archive* a;
+        if (options.flag("append")) {
+            a = Archive::append(rei->rsComm, archive, collection, resource);
+        }
+        else {
+            a = Archive::create(rei->rsComm, archive, sources.empty() ? collection : "", resource);
+            if (a != NULL) {
+                a->reserveIndex((size_t) std::max(options.integer("indexReserve", 0), 0LL));
+            }
+        }
         if (a == NULL) {
             status = SYS_TAR_OPEN_ERR;
         }
         else {
+            if (options.get("indexVersion") != NULL) {
+                a->indexVersion((int) options.integer("indexVersion", A_VERSION));
+            }
+            if (options.get("indexFormat") != NULL) {
+                a->binaryIndex(strcmp(options.get("indexFormat"), "cbor") == 0);
+            }
+            if (options.get("zipCompression") != NULL) {
+                if (strcmp(options.get("zipCompression"), "deflate") == 0) {
+                    a->zipCompression(Archive::COMPRESS_DEFLATE);
+                }
+                else if (strcmp(options.get("zipCompression"), "store") == 0) {
+                    a->zipCompression(Archive::COMPRESS_STORE);
+                }
+            }
+            a->compressionThreads((size_t) std::max(options.integer("zipThreads", A_ZIPTHREADS), 1LL));
+            if (options.get("order") != NULL) {
+                if (strcmp(options.get("order"), "location") == 0) {
+                    a->orderBy(ItemTable::ORDER_LOCATION);
+                }
+                else if (strcmp(options.get("order"), "size") == 0) {
+                    a->orderBy(ItemTable::ORDER_SIZE);
+                }
+            }
+
             /*
              * add collections and DataObjs to archive
              */
-            dirColl(a, rei->rsComm, collection, collection);
-            dirDataObj(a, rei->rsComm, "", id);
+            ReplicaChoice choice(rei->rsComm, options.list("replicaResources"));
+            if (sources.empty()) {
+                dirColl(a, rei->rsComm, choice, collection, collection);
+                dirDataObj(a, rei->rsComm, choice, "", id);
+                status = 0;
+            }
+            else {
+                status = dirSources(a, rei->rsComm, choice, sources, isColl);
+            }
 
             /*
              * actually construct the archive
              */
-            status = a->construct();
+            if (worker != NULL) {
+                a->onProgress([&job](size_t items, size_t totalItems, size_t bytes, size_t totalBytes) {
+                    return job.progress(items, totalItems, bytes, totalBytes);
+                });
+            }
+            if (status == 0) {
+                status = a->construct();
+            }
+            if (status == 0 && options.flag("sidecar")) {
+                status = a->sidecar(options.get("sidecarResource"));
+            }
             delete a;
         }
     }
+    if (worker != NULL) {
+        job.finish(status);
+    }
 
     fillIntInMsParam(statusOut, status);
     return status;
@@ -8,11 +8,28 @@
 
 #include "irods_includes.hh"
 #include "Archive.hh"
+#include "ArchiveJob.hh"
+#include "CredentialsStore.hh"
+#include "Digest.hh"
+#include "Options.hh"
 
 #include "rsGenQuery.hpp"
 #include "rsModDataObjMeta.hpp"
 #include "rsModAVUMetadata.hpp"
 
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define A_STAGINGROOTS "archive_staging_roots" /* key in the credentials store */
+
 /*
  * obtain free space on resource, if set
  */
@@ -48,6 +65,104 @@ static long long freeSpace(rsComm_t* rsComm, const char* resource)
     return space;
 }
 
+/*
+ * Placement of extracted DataObjs on one or more resources. DataObjs are
+ * either distributed round-robin, or to the resource with the most free
+ * space left after the DataObjs already placed on it, or by size: large
+ * DataObjs go to the first resource, the others round-robin to the rest.
+ */
+class Placement
+{
+  public:
+    enum
+    {
+        ROUND_ROBIN,
+        FREE_SPACE,
+        SIZE
+    };
+
+    Placement(std::vector<std::string> resources, int policy, long long threshold)
+        : resources(resources)
+        , policy(policy)
+        , threshold(threshold)
+        , next(0)
+    {
+        space.resize(resources.size(), 0);
+        planned.resize(resources.size(), 0);
+    }
+
+    /*
+     * obtain the free space of all resources, return status
+     */
+    int init(rsComm_t* rsComm)
+    {
+        for (size_t i = 0; i < resources.size(); i++) {
+            space[i] = freeSpace(rsComm, resources[i].c_str());
+            if (space[i] < 0) {
+                return (int) space[i];
+            }
+        }
+        return 0;
+    }
+
+    /*
+     * choose a resource for a DataObj, or NULL for the default resource
+     */
+    const char* place(long long size)
+    {
+        size_t i, best;
+
+        if (resources.empty()) {
+            return NULL;
+        }
+        if (policy == FREE_SPACE) {
+            /*
+             * most space left, resources with unknown free space last
+             */
+            best = 0;
+            for (i = 1; i < resources.size(); i++) {
+                if (space[i] - planned[i] > space[best] - planned[best] ||
+                    (space[i] - planned[i] == space[best] - planned[best] && planned[i] < planned[best]))
+                {
+                    best = i;
+                }
+            }
+        }
+        else if (policy == SIZE && (size >= threshold || resources.size() == 1)) {
+            best = 0;
+        }
+        else if (policy == SIZE) {
+            best = 1 + next++ % (resources.size() - 1);
+        }
+        else {
+            best = next++ % resources.size();
+        }
+        planned[best] += size;
+        return resources[best].c_str();
+    }
+
+    /*
+     * do the DataObjs placed so far fit, keeping 10% of each resource free?
+     */
+    bool fits()
+    {
+        for (size_t i = 0; i < resources.size(); i++) {
+            if (space[i] != 0 && planned[i] > space[i] - space[i] / 10) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  private:
+    std::vector<std::string> resources; /* resources to extract to */
+    int policy; /* placement policy */
+    long long threshold; /* minimum size of large DataObjs */
+    size_t next; /* round-robin counter */
+    std::vector<long long> space; /* free space of each resource, 0 if unknown */
+    std::vector<long long> planned; /* bytes placed on each resource */
+};
+
 /*
  * change the modification time for an extracted DataObj
  */
@@ -95,6 +210,237 @@ static void attributes(rsComm_t* rsComm, std::string& file, const char* type, js
     }
 }
 
+/*
+ * does a member name stay within the directory it is extracted to?
+ */
+static bool safeName(const std::string& name)
+{
+    size_t start, end;
+
+    if (name.empty() || name[0] == '/') {
+        return false;
+    }
+    for (start = 0; start <= name.length(); start = end + 1) {
+        end = name.find('/', start);
+        if (end == std::string::npos) {
+            end = name.length();
+        }
+        if (name.compare(start, end - start, "..") == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Open a directory below an open directory, one component at a time
+ * without following symbolic links, optionally creating the components.
+ * An empty name opens the directory itself. Return a file descriptor or a
+ * negative status.
+ */
+static int openDirs(int dirfd, const std::string& name, bool create)
+{
+    std::string component;
+    size_t start, end;
+    int fd, next, err;
+
+    fd = dup(dirfd);
+    if (fd < 0) {
+        return UNIX_FILE_OPEN_ERR - errno;
+    }
+    for (start = 0; start < name.length(); start = end + 1) {
+        end = name.find('/', start);
+        if (end == std::string::npos) {
+            end = name.length();
+        }
+        component = name.substr(start, end - start);
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        if (create && mkdirat(fd, component.c_str(), 0750) < 0 && errno != EEXIST) {
+            err = errno;
+            close(fd);
+            return UNIX_FILE_MKDIR_ERR - err;
+        }
+        next = openat(fd, component.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        err = errno;
+        close(fd);
+        if (next < 0) {
+            return UNIX_FILE_OPEN_ERR - err;
+        }
+        fd = next;
+    }
+    return fd;
+}
+
+/*
+ * Check and create a local staging directory, which must be within one of
+ * the staging roots listed in the credentials store, separated by colons.
+ * The root is resolved and opened, and the rest of the path is created and
+ * opened below it without following symbolic links, so that nothing is
+ * created outside the roots. Return a file descriptor for the staging
+ * directory, or a negative status.
+ */
+static int stagingDir(std::string& path)
+{
+    CredentialsStore store;
+    char root[PATH_MAX];
+    std::string roots, prefix;
+    size_t start, end;
+    int rootfd, fd;
+
+    if (!store.has(A_STAGINGROOTS) || store.get(A_STAGINGROOTS) == NULL) {
+        rodsLog(LOG_ERROR, "msiArchiveExtract: no staging roots configured");
+        return SYS_CONFIG_FILE_ERR;
+    }
+    roots = store.get(A_STAGINGROOTS);
+    while (path.length() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    if (path.empty() || !safeName(path.substr(1))) {
+        return SYS_INVALID_FILE_PATH;
+    }
+
+    for (start = 0; start <= roots.length(); start = end + 1) {
+        end = roots.find(':', start);
+        if (end == std::string::npos) {
+            end = roots.length();
+        }
+        prefix = roots.substr(start, end - start);
+        while (prefix.length() > 1 && prefix.back() == '/') {
+            prefix.pop_back();
+        }
+        if (prefix.empty() || prefix[0] != '/' ||
+            (path.compare(prefix) != 0 && path.compare(0, prefix.length() + 1, prefix + "/") != 0))
+        {
+            continue;
+        }
+
+        /*
+         * the configured root itself may contain symbolic links
+         */
+        if (realpath(prefix.c_str(), root) == NULL) {
+            return SYS_INVALID_FILE_PATH;
+        }
+        rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (rootfd < 0) {
+            return UNIX_FILE_OPEN_ERR - errno;
+        }
+        fd = openDirs(rootfd, path.substr(prefix.length()), true);
+        close(rootfd);
+        if (fd < 0) {
+            rodsLog(LOG_ERROR, "msiArchiveExtract: cannot create staging directory %s", path.c_str());
+        }
+        return fd;
+    }
+
+    rodsLog(LOG_ERROR, "msiArchiveExtract: %s is not within a staging root", path.c_str());
+    return SYS_INVALID_FILE_PATH;
+}
+
+/*
+ * is there room for the given number of bytes in the file system of the
+ * staging directory?
+ */
+static bool stagingFits(int dirfd, size_t size)
+{
+    struct statvfs vfs;
+
+    if (fstatvfs(dirfd, &vfs) != 0) {
+        return true; /* let the writes fail instead */
+    }
+    return ((unsigned long long) vfs.f_bavail * vfs.f_frsize >= size);
+}
+
+/*
+ * Write the current member of an archive to a local file below the staging
+ * directory, in large sequential writes, and give it the modification time
+ * from the index. Optionally verify the checksum in the index while
+ * writing, counting the members that have no checksum to verify. The file
+ * is removed if anything goes wrong.
+ */
+static int stageDataObj(Archive* a,
+                        int dirfd,
+                        const std::string& name,
+                        json_t* json,
+                        bool verify,
+                        size_t& unverified,
+                        std::vector<char>& buf)
+{
+    struct timespec times[2];
+    const char* checksum;
+    std::string base;
+    size_t len, done, pos;
+    __LA_SSIZE_T n;
+    ssize_t written;
+    int parent, fd, status;
+
+    checksum = json_string_value(json_object_get(json, "checksum"));
+    Digest digest((verify && checksum != NULL) ? Digest::algorithmOf(checksum) : "");
+    if (verify && !digest.valid()) {
+        unverified++;
+    }
+
+    pos = name.rfind('/');
+    parent = openDirs(dirfd, (pos != std::string::npos) ? name.substr(0, pos) : "", true);
+    if (parent < 0) {
+        return parent;
+    }
+    base = (pos != std::string::npos) ? name.substr(pos + 1) : name;
+    fd = openat(parent, base.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        status = UNIX_FILE_OPEN_ERR - errno;
+        close(parent);
+        return status;
+    }
+    status = 0;
+    do {
+        /*
+         * fill the buffer, then write it
+         */
+        for (len = 0; len < buf.size(); len += (size_t) n) {
+            n = a->readEntry(&buf[len], buf.size() - len);
+            if (n <= 0) {
+                break;
+            }
+        }
+        if (n < 0) {
+            status = SYS_TAR_EXTRACT_ALL_ERR;
+            break;
+        }
+        digest.update(buf.data(), len);
+        for (done = 0; done < len; done += (size_t) written) {
+            written = write(fd, &buf[done], len - done);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    written = 0;
+                    continue;
+                }
+                status = UNIX_FILE_WRITE_ERR - errno;
+                break;
+            }
+        }
+    } while (status == 0 && n > 0);
+
+    if (status == 0) {
+        times[0].tv_sec = times[1].tv_sec = (time_t) json_integer_value(json_object_get(json, "modified"));
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        futimens(fd, times); /* allowed to fail */
+    }
+    if (close(fd) < 0 && status == 0) {
+        status = UNIX_FILE_CLOSE_ERR - errno;
+    }
+    if (status == 0 && digest.valid() && digest.checksum().compare(checksum) != 0) {
+        rodsLog(LOG_ERROR, "msiArchiveExtract: checksum mismatch for %s", name.c_str());
+        status = USER_CHKSUM_MISMATCH;
+    }
+    if (status < 0) {
+        unlinkat(parent, base.c_str(), 0); /* no partial or corrupt files */
+    }
+    close(parent);
+    return status;
+}
+
 extern "C" {
 
 int msiArchiveExtract(msParam_t* archiveIn,
@@ -106,8 +452,11 @@ int msiArchiveExtract(msParam_t* archiveIn,
 {
     collInp_t collCreateInp;
     json_t* json;
-    int status;
-    long long space;
+    int status, policy, stagefd;
+    size_t i, items, totalItems, bytes, totalBytes, unverified;
+    bool worker, staging;
+    std::vector<std::pair<std::string, time_t>> dirs;
+    std::vector<char> buf;
 
     /* Check input parameters. */
     if (archiveIn->type == NULL || strcmp(archiveIn->type, STR_MS_T)) {
@@ -129,65 +478,186 @@ int msiArchiveExtract(msParam_t* archiveIn,
     if (extractIn->type != NULL && strcmp(extractIn->type, STR_MS_T) == 0) {
         extract = parseMspForStr(extractIn);
     }
-    const char* resource = NULL;
-    if (resourceIn->type != NULL && strcmp(resourceIn->type, STR_MS_T) == 0) {
-        resource = parseMspForStr(resourceIn);
+
+    /*
+     * The fourth parameter is either the name of the resource, or a list of
+     * options:
+     *   resource:      comma separated list of resources to extract to
+     *   placement:     "roundRobin" (default), "freeSpace" to place
+     *                  DataObjs where most space is left, or "size" to
+     *                  place large DataObjs on the first resource and the
+     *                  others on the remaining resources
+     *   sizeThreshold: minimum size of large DataObjs, default 1 GiB
+     *   staging:       extract to a local directory on this server instead
+     *                  of a collection; rodsadmin only, and the directory
+     *                  must be within a configured staging root
+     *   verify:        with staging, verify the checksums in the index;
+     *                  DataObjs without a usable checksum are counted in
+     *                  the log
+     *   job:           extract in the background, see msiArchiveJobStatus
+     */
+    Options options(resourceIn, "resource");
+    policy = Placement::ROUND_ROBIN;
+    if (options.get("placement") != NULL) {
+        if (strcmp(options.get("placement"), "freeSpace") == 0) {
+            policy = Placement::FREE_SPACE;
+        }
+        else if (strcmp(options.get("placement"), "size") == 0) {
+            policy = Placement::SIZE;
+        }
+    }
+    Placement placement(options.list("resource"), policy, options.integer("sizeThreshold", 1LL << 30));
+    staging = options.flag("staging");
+    if (staging && rei->uoic->authInfo.authFlag < LOCAL_PRIV_USER_AUTH) {
+        return SYS_USER_NO_PERMISSION;
+    }
+    ArchiveJob job(rei->rsComm, archive, "extract");
+    worker = (options.get("jobWorker") != NULL); /* set by the delayed rule of a job only */
+    if (options.flag("job")) {
+        /*
+         * let a delayed rule do the work
+         */
+        if (worker) {
+            fillIntInMsParam(statusOut, SYS_INVALID_INPUT_PARAM);
+            return SYS_INVALID_INPUT_PARAM;
+        }
+        status = job.submit(rei,
+                            "msiArchiveExtract(" + ArchiveJob::quote(archive) + ", " + ArchiveJob::quote(path) + ", " +
+                                ArchiveJob::quote((extract != NULL) ? extract : "null") + ", *options, *status)",
+                            options.serialize("job"));
+        fillIntInMsParam(statusOut, status);
+        return status;
+    }
+    if (worker) {
+        status = job.start(options.get("jobWorker"));
+        if (status < 0) {
+            job.finish(status);
+            fillIntInMsParam(statusOut, status);
+            return status;
+        }
     }
 
-    Archive* a = Archive::open(rei->rsComm, archive, resource);
-    if (a == NULL) {
+    stagefd = -1;
+    status = 0;
+    if (staging) {
+        stagefd = stagingDir(path);
+        status = (stagefd < 0) ? stagefd : 0;
+    }
+    Archive* a = (status == 0) ? Archive::open(rei->rsComm, archive, NULL) : NULL;
+    if (status == 0 && a == NULL) {
         status = SYS_TAR_OPEN_ERR;
     }
-    else {
-        status = 0;
-        space = 0;
-        if (resource != NULL) {
+    else if (a != NULL) {
+        /*
+         * place the DataObjs to extract, and see if there is enough free
+         * space; staging writes to the local file system instead of the
+         * resources
+         */
+        std::vector<const char*> resources(json_array_size(a->items()), NULL);
+        status = staging ? 0 : placement.init(rei->rsComm);
+        totalItems = totalBytes = 0;
+        for (i = 0; status == 0 && i < resources.size(); i++) {
+            json = json_array_get(a->items(), i);
+            if (!json_is_true(json_object_get(json, "superseded")) &&
+                (extract == NULL || strcmp(json_string_value(json_object_get(json, "name")), extract) == 0))
+            {
+                totalItems++;
+                if (strcmp(json_string_value(json_object_get(json, "type")), "coll") != 0) {
+                    if (!staging) {
+                        resources[i] = placement.place(json_integer_value(json_object_get(json, "size")));
+                    }
+                    totalBytes += (size_t) json_integer_value(json_object_get(json, "size"));
+                }
+                if (extract != NULL) {
+                    break;
+                }
+            }
+        }
+        if (status == 0 && (staging ? !stagingFits(stagefd, totalBytes) : !placement.fits())) {
             /*
-             * see if there is enough free space
+             * the choice of status code is rather a shot in the dark
              */
-            space = freeSpace(rei->rsComm, resource);
-            if (space < 0) {
-                status = (int) space;
-            }
-            else if (space != 0 && extract == NULL && a->size() > (size_t) (space - space / 10)) {
-                /*
-                 * the choice of status code is rather a shot in the dark
-                 */
-                status = SYS_RESC_QUOTA_EXCEEDED;
+            status = SYS_RESC_QUOTA_EXCEEDED;
+        }
+        if (status < 0) {
+            delete a;
+            if (stagefd >= 0) {
+                close(stagefd);
             }
-            if (status < 0) {
-                delete a;
-                fillIntInMsParam(statusOut, status);
-                return status;
+            if (worker) {
+                job.finish(status);
             }
+            fillIntInMsParam(statusOut, status);
+            return status;
         }
 
         /*
          * create extraction location (allowed to fail)
          */
-        memset(&collCreateInp, '\0', sizeof(collInp_t));
-        rstrcpy(collCreateInp.collName, path.c_str(), MAX_NAME_LEN);
-        rsCollCreate(rei->rsComm, &collCreateInp);
+        if (!staging) {
+            memset(&collCreateInp, '\0', sizeof(collInp_t));
+            rstrcpy(collCreateInp.collName, path.c_str(), MAX_NAME_LEN);
+            rsCollCreate(rei->rsComm, &collCreateInp);
+        }
 
         /*
          * extract items
          */
-        while ((json = a->nextItem()) != NULL) {
+        items = bytes = unverified = 0;
+        for (i = 0; (json = a->nextItem()) != NULL; i++) {
             std::string file;
             const char* type;
             json_t* list;
 
+            /*
+             * skip items that were replaced by a later append
+             */
+            if (json_is_true(json_object_get(json, "superseded"))) {
+                continue;
+            }
+
             file = json_string_value(json_object_get(json, "name"));
-            if (extract == NULL || file.compare(extract) == 0) {
-                if (extract != NULL) {
-                    if (space != 0 && json_integer_value(json_object_get(json, "size")) > space - space / 10) {
-                        /*
-                         * single-file space check failed
-                         */
-                        status = SYS_RESC_QUOTA_EXCEEDED;
+            if (staging && (extract == NULL || file.compare(extract) == 0)) {
+                /*
+                 * extract to the staging directory
+                 */
+                if (!safeName(file)) {
+                    rodsLog(LOG_ERROR, "msiArchiveExtract: refusing to stage %s", file.c_str());
+                    status = SYS_INVALID_FILE_PATH;
+                    break;
+                }
+                type = json_string_value(json_object_get(json, "type"));
+                if (strcmp(type, "coll") == 0) {
+                    int fd = openDirs(stagefd, file, true);
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                    status = (fd < 0) ? fd : 0;
+                    dirs.push_back(
+                        std::make_pair(file, (time_t) json_integer_value(json_object_get(json, "modified"))));
+                }
+                else {
+                    if (buf.empty()) {
+                        buf.resize(A_BUFSIZE);
+                    }
+                    status = stageDataObj(a, stagefd, file, json, options.flag("verify"), unverified, buf);
+                    bytes += (size_t) json_integer_value(json_object_get(json, "size"));
+                }
+                if (status < 0) {
+                    break;
+                }
+                if (worker) {
+                    status = job.progress(++items, totalItems, bytes, totalBytes);
+                    if (status < 0) {
                         break;
                     }
-
+                }
+                if (extract != NULL) {
+                    break;
+                }
+            }
+            else if (extract == NULL || file.compare(extract) == 0) {
+                if (extract != NULL) {
                     std::string::size_type found = file.rfind("/");
                     if (found != std::string::npos) {
                         collInp_t collCreateInp;
@@ -203,7 +673,7 @@ int msiArchiveExtract(msParam_t* archiveIn,
                 }
                 file = path + "/" + file;
 
-                status = a->extractItem(file);
+                status = a->extractItem(file, resources[i]);
                 if (status < 0) {
                     break;
                 }
@@ -213,7 +683,7 @@ int msiArchiveExtract(msParam_t* archiveIn,
                  * of policies, and thus allowed to fail.
                  */
                 type = json_string_value(json_object_get(json, "type"));
-                list = json_object_get(json, "attributes");
+                list = a->attributes(json);
                 if (strcmp(type, "coll") == 0) {
                     if (list != NULL) {
                         attributes(rei->rsComm, file, "-C", list);
@@ -224,14 +694,50 @@ int msiArchiveExtract(msParam_t* archiveIn,
                     if (list != NULL) {
                         attributes(rei->rsComm, file, "-d", list);
                     }
+                    bytes += (size_t) json_integer_value(json_object_get(json, "size"));
                 }
 
+                if (worker) {
+                    status = job.progress(++items, totalItems, bytes, totalBytes);
+                    if (status < 0) {
+                        break;
+                    }
+                }
                 if (extract != NULL) {
                     break;
                 }
             }
         }
         delete a;
+        if (unverified != 0) {
+            rodsLog(LOG_NOTICE,
+                    "msiArchiveExtract: %zu DataObjs staged from %s had no checksum to verify",
+                    unverified,
+                    archive.c_str());
+        }
+
+        /*
+         * directories get their modification times last, deepest first,
+         * since creating their contents changed them
+         */
+        for (auto dir = dirs.rbegin(); dir != dirs.rend(); dir++) {
+            struct timespec times[2];
+            int fd;
+
+            times[0].tv_sec = times[1].tv_sec = dir->second;
+            times[0].tv_nsec = times[1].tv_nsec = 0;
+            fd = openDirs(stagefd, dir->first, false);
+            if (fd >= 0) {
+                futimens(fd, times); /* allowed to fail */
+                close(fd);
+            }
+        }
+    }
+    if (stagefd >= 0) {
+        close(stagefd);
+    }
+    if (worker) {
+        job.finish(status);
     }
 
     fillIntInMsParam(statusOut, status);
@@ -25,7 +25,7 @@ int msiArchiveIndex(msParam_t* archiveIn, msParam_t* indexOut, ruleExecInfo_t* r
     }
     std::string archive = archiveStr;
 
-    Archive* a = Archive::open(rei->rsComm, archive, NULL);
+    Archive* a = Archive::openIndex(rei->rsComm, archive);
     if (a == NULL) {
         return SYS_TAR_OPEN_ERR;
     }
@@ -0,0 +1,72 @@
+/**
+ * \file
+ * \brief     ArchiveIndexQuery
+ * \copyright Copyright (c) 2026, Utrecht University
+ */
+
+#include "irods_includes.hh"
+#include "Archive.hh"
+#include "Options.hh"
+
+/*
+ * obtain an optional string parameter
+ */
+static const char* strParam(msParam_t* param)
+{
+    if (param->type != NULL && strcmp(param->type, STR_MS_T) == 0) {
+        return parseMspForStr(param);
+    }
+    return NULL;
+}
+
+extern "C" {
+
+int msiArchiveIndexQuery(msParam_t* archiveIn,
+                         msParam_t* offsetIn,
+                         msParam_t* limitIn,
+                         msParam_t* filterIn,
+                         msParam_t* fieldsIn,
+                         msParam_t* indexOut,
+                         ruleExecInfo_t* rei)
+{
+    /* Check input parameters. */
+    if (archiveIn->type == NULL || strcmp(archiveIn->type, STR_MS_T)) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    /* Parse input parameters. */
+    const char* archiveStr = parseMspForStr(archiveIn);
+    if (archiveStr == NULL) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    std::string archive = archiveStr;
+    long long offset = Options::intParam(offsetIn);
+    long long limit = Options::intParam(limitIn);
+    if (offset < 0 || limit < 0) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    const char* filter = strParam(filterIn);
+    const char* fields = strParam(fieldsIn);
+
+    Archive* a = Archive::openIndex(rei->rsComm, archive);
+    if (a == NULL) {
+        return SYS_TAR_OPEN_ERR;
+    }
+    fillStrInMsParam(indexOut, a->queryItems((size_t) offset, (size_t) limit, filter, fields).c_str());
+    delete a;
+
+    return 0;
+}
+
+irods::ms_table_entry* plugin_factory()
+{
+    irods::ms_table_entry* msvc = new irods::ms_table_entry(6);
+
+    msvc->add_operation<msParam_t*, msParam_t*, msParam_t*, msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*>(
+        "msiArchiveIndexQuery",
+        std::function<int(msParam_t*, msParam_t*, msParam_t*, msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*)>(
+            msiArchiveIndexQuery));
+
+    return msvc;
+}
+}
@@ -0,0 +1,68 @@
+/**
+ * \file
+ * \brief     ArchiveJobStatus
+ * \copyright Copyright (c) 2026, Utrecht University
+ */
+
+#include "irods_includes.hh"
+#include "Archive.hh"
+#include "ArchiveJob.hh"
+
+extern "C" {
+
+int msiArchiveJobStatus(msParam_t* archiveIn, msParam_t* actionIn, msParam_t* statusOut, ruleExecInfo_t* rei)
+{
+    json_t* json;
+    char* str;
+    int status;
+
+    /* Check input parameters. */
+    if (archiveIn->type == NULL || strcmp(archiveIn->type, STR_MS_T)) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    /* Parse input parameters. */
+    const char* archiveStr = parseMspForStr(archiveIn);
+    if (archiveStr == NULL) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    std::string archive = archiveStr;
+    const char* action = NULL;
+    if (actionIn->type != NULL && strcmp(actionIn->type, STR_MS_T) == 0) {
+        action = parseMspForStr(actionIn);
+    }
+
+    /*
+     * The action is either empty, to obtain the status of the background
+     * job on the archive, or "cancel" to also cancel it.
+     */
+    if (action != NULL && strcmp(action, "cancel") == 0) {
+        status = ArchiveJob::cancel(rei->rsComm, archive);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    json = ArchiveJob::status(rei->rsComm, archive);
+    if (json == NULL) {
+        return OBJ_PATH_DOES_NOT_EXIST;
+    }
+    str = json_dumps(json, 0);
+    json_decref(json);
+    fillStrInMsParam(statusOut, str);
+    free(str);
+
+    return 0;
+}
+
+irods::ms_table_entry* plugin_factory()
+{
+    irods::ms_table_entry* msvc = new irods::ms_table_entry(3);
+
+    msvc->add_operation<msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*>(
+        "msiArchiveJobStatus",
+        std::function<int(msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*)>(msiArchiveJobStatus));
+
+    return msvc;
+}
+}
@@ -0,0 +1,149 @@
+/**
+ * \file
+ * \brief     ArchiveReadMember
+ * \copyright Copyright (c) 2026, Utrecht University
+ */
+
+#include "irods_includes.hh"
+#include "Archive.hh"
+#include "Options.hh"
+
+#define A_MAXREAD (32 * 1024 * 1024)
+
+/*
+ * Read part of a member by going through the archive. Return the number of
+ * bytes read, or a negative status.
+ */
+static int readEntry(Archive* a, size_t offset, size_t length, char* buf)
+{
+    char skip[A_BUFSIZE];
+    __LA_SSIZE_T len;
+    size_t done;
+
+    for (done = 0; done < offset; done += (size_t) len) {
+        len = a->readEntry(skip, std::min(offset - done, sizeof(skip)));
+        if (len <= 0) {
+            return (len < 0) ? SYS_TAR_EXTRACT_ALL_ERR : 0;
+        }
+    }
+    for (done = 0; done < length; done += (size_t) len) {
+        len = a->readEntry(buf + done, length - done);
+        if (len <= 0) {
+            if (len < 0) {
+                return SYS_TAR_EXTRACT_ALL_ERR;
+            }
+            break;
+        }
+    }
+    return (int) done;
+}
+
+extern "C" {
+
+int msiArchiveReadMember(msParam_t* archiveIn,
+                         msParam_t* memberIn,
+                         msParam_t* offsetIn,
+                         msParam_t* lengthIn,
+                         msParam_t* bufOut,
+                         ruleExecInfo_t* rei)
+{
+    bytesBuf_t* bytesBuf;
+    json_t* item;
+    size_t size;
+    int status;
+
+    /* Check input parameters. */
+    if (archiveIn->type == NULL || strcmp(archiveIn->type, STR_MS_T)) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    if (memberIn->type == NULL || strcmp(memberIn->type, STR_MS_T)) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    /* Parse input parameters. */
+    const char* archiveStr = parseMspForStr(archiveIn);
+    const char* memberStr = parseMspForStr(memberIn);
+    if (archiveStr == NULL || memberStr == NULL) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    std::string archive = archiveStr;
+    std::string member = memberStr;
+    long long offset = Options::intParam(offsetIn);
+    long long length = Options::intParam(lengthIn);
+    if (offset < 0 || length < 0) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    /*
+     * look up the member in the index, which is usually cached
+     */
+    Archive* a = Archive::openIndex(rei->rsComm, archive);
+    if (a == NULL) {
+        return SYS_TAR_OPEN_ERR;
+    }
+    item = a->item(member.c_str());
+    if (item == NULL || strcmp(json_string_value(json_object_get(item, "type")), "dataObj") != 0) {
+        delete a;
+        return OBJ_PATH_DOES_NOT_EXIST;
+    }
+
+    /*
+     * a length of 0 means up to the end of the member
+     */
+    size = (size_t) json_integer_value(json_object_get(item, "size"));
+    if ((size_t) offset > size) {
+        offset = (long long) size;
+    }
+    if (length == 0 || (size_t) length > size - (size_t) offset) {
+        length = (long long) (size - (size_t) offset);
+    }
+    if (length > A_MAXREAD) {
+        rodsLog(LOG_ERROR, "msiArchiveReadMember: cannot read more than %d bytes at once", A_MAXREAD);
+        delete a;
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    bytesBuf = (bytesBuf_t*) malloc(sizeof(bytesBuf_t));
+    bytesBuf->buf = malloc((size_t) length + 1);
+    status = a->readAt(item, (size_t) offset, (size_t) length, (char*) bytesBuf->buf);
+    if (status < 0) {
+        /*
+         * no usable offset, read through the archive instead
+         */
+        delete a;
+        a = Archive::open(rei->rsComm, archive, NULL);
+        if (a == NULL) {
+            status = SYS_TAR_OPEN_ERR;
+        }
+        else if ((item = a->item(member.c_str())) == NULL || !a->findEntry(item)) {
+            status = SYS_TAR_EXTRACT_ALL_ERR;
+        }
+        else {
+            status = readEntry(a, (size_t) offset, (size_t) length, (char*) bytesBuf->buf);
+        }
+    }
+    delete a;
+
+    if (status < 0) {
+        free(bytesBuf->buf);
+        free(bytesBuf);
+        return status;
+    }
+    ((char*) bytesBuf->buf)[status] = '\0';
+    bytesBuf->len = status;
+    fillBufLenInMsParam(bufOut, status, bytesBuf);
+    return 0;
+}
+
+irods::ms_table_entry* plugin_factory()
+{
+    irods::ms_table_entry* msvc = new irods::ms_table_entry(5);
+
+    msvc->add_operation<msParam_t*, msParam_t*, msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*>(
+        "msiArchiveReadMember",
+        std::function<int(msParam_t*, msParam_t*, msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*)>(
+            msiArchiveReadMember));
+
+    return msvc;
+}
+}
@@ -0,0 +1,268 @@
+/**
+ * \file
+ * \brief     ArchiveVerify
+ * \copyright Copyright (c) 2026, Utrecht University
+ */
+
+#include "irods_includes.hh"
+#include "Archive.hh"
+#include "Digest.hh"
+#include "ThreadPool.hh"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#define A_THREADS 4
+#define A_QUEUED  8
+
+/*
+ * a corrupt member
+ */
+struct Problem
+{
+    std::string name; /* name of the member */
+    std::string reason; /* what is wrong with it */
+    std::string expected; /* expected value, or empty */
+    std::string actual; /* actual value */
+};
+
+/*
+ * Verification of an archive against its index. The archive is read once,
+ * in the agent thread; the data of each member is hashed on a worker, so
+ * that decompression and hashing overlap.
+ */
+class Verifier
+{
+  public:
+    Verifier(Archive* a)
+        : a(a)
+        , pool(A_THREADS, A_QUEUED)
+        , checked(0)
+        , unchecked(0)
+    {
+        json_t* json;
+
+        for (size_t i = 0; i < json_array_size(a->items()); i++) {
+            json = json_array_get(a->items(), i);
+            items[json_string_value(json_object_get(json, "name"))].push_back(json);
+        }
+    }
+
+    /*
+     * read through the archive and produce a report
+     */
+    json_t* verify()
+    {
+        const char* name;
+        size_t member;
+        int status;
+
+        status = 0;
+        for (member = 0; (name = a->nextEntry()) != NULL; member++) {
+            /*
+             * collections are stored with a trailing slash
+             */
+            std::string entry = name;
+            if (entry.length() > 1 && entry.back() == '/') {
+                entry.pop_back();
+            }
+            name = entry.c_str();
+
+            /*
+             * a name occurs more than once if the item was modified and
+             * appended again; the members are in the same order as the items
+             */
+            auto item = items.find(name);
+            if (item == items.end() || item->second.empty()) {
+                extra.push_back(name);
+                continue;
+            }
+            json_t* json = item->second.front();
+            item->second.pop_front();
+
+            if (a->isColl() != (strcmp(json_string_value(json_object_get(json, "type")), "coll") == 0)) {
+                problem(name, "type", "", "");
+            }
+            else if (!a->isColl()) {
+                status = hashMember(member, name, json);
+                if (status < 0) {
+                    break;
+                }
+            }
+        }
+        pool.wait();
+
+        return report(status);
+    }
+
+  private:
+    /*
+     * hash the data of a member on a worker, then compare it with the index
+     */
+    int hashMember(size_t member, std::string name, json_t* json)
+    {
+        std::shared_ptr<Digest> digest;
+        std::string expected;
+        size_t size, expectedSize;
+        __LA_SSIZE_T len;
+
+        expectedSize = (size_t) json_integer_value(json_object_get(json, "size"));
+        if (json_object_get(json, "checksum") != NULL) {
+            expected = json_string_value(json_object_get(json, "checksum"));
+            digest = std::make_shared<Digest>(Digest::algorithmOf(expected.c_str()));
+        }
+        if (digest == NULL || !digest->valid()) {
+            digest = NULL;
+            unchecked++;
+        }
+
+        for (size = 0;; size += (size_t) len) {
+            auto chunk = std::make_shared<std::vector<char>>(A_BUFSIZE);
+            len = a->readEntry(chunk->data(), chunk->size());
+            if (len <= 0) {
+                break;
+            }
+            if (digest != NULL) {
+                chunk->resize((size_t) len);
+                pool.submit(member, [digest, chunk] { digest->update(chunk->data(), chunk->size()); });
+            }
+        }
+        if (len < 0) {
+            problem(name, "read", "", "");
+            return SYS_TAR_EXTRACT_ALL_ERR;
+        }
+
+        checked++;
+        if (size != expectedSize) {
+            problem(name, "size", std::to_string(expectedSize), std::to_string(size));
+        }
+        else if (digest != NULL) {
+            pool.submit(member, [this, digest, name, expected] {
+                std::string actual = digest->checksum();
+                if (actual != expected) {
+                    problem(name, "checksum", expected, actual);
+                }
+            });
+        }
+        return 0;
+    }
+
+    /*
+     * record a corrupt member, possibly from a worker
+     */
+    void problem(const std::string& name, const char* reason, const std::string& expected, const std::string& actual)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        corrupt.push_back({name, reason, expected, actual});
+    }
+
+    /*
+     * build the report
+     */
+    json_t* report(int status)
+    {
+        json_t *json, *list;
+
+        json = json_object();
+        json_object_set_new(json, "checked", json_integer((json_int_t) checked));
+        json_object_set_new(json, "unchecked", json_integer((json_int_t) unchecked));
+
+        list = json_array();
+        for (auto item = items.begin(); item != items.end(); item++) {
+            if (!item->second.empty()) {
+                json_array_append_new(list, json_string(item->first.c_str()));
+            }
+        }
+        json_object_set_new(json, "missing", list);
+
+        list = json_array();
+        for (auto name = extra.begin(); name != extra.end(); name++) {
+            json_array_append_new(list, json_string(name->c_str()));
+        }
+        json_object_set_new(json, "extra", list);
+
+        list = json_array();
+        for (auto item = corrupt.begin(); item != corrupt.end(); item++) {
+            json_t* problem;
+
+            problem = json_object();
+            json_object_set_new(problem, "name", json_string(item->name.c_str()));
+            json_object_set_new(problem, "reason", json_string(item->reason.c_str()));
+            if (!item->expected.empty()) {
+                json_object_set_new(problem, "expected", json_string(item->expected.c_str()));
+                json_object_set_new(problem, "actual", json_string(item->actual.c_str()));
+            }
+            json_array_append_new(list, problem);
+        }
+        json_object_set_new(json, "corrupt", list);
+
+        json_object_set_new(json,
+                            "ok",
+                            json_boolean(status == 0 && json_array_size(json_object_get(json, "missing")) == 0 &&
+                                         extra.empty() && corrupt.empty()));
+        return json;
+    }
+
+    Archive* a; /* archive to verify */
+    ThreadPool pool; /* hashing workers */
+    std::map<std::string, std::deque<json_t*>> items; /* items in the index not yet found in the archive */
+    std::vector<std::string> extra; /* members not in the index */
+    std::vector<Problem> corrupt; /* corrupt members */
+    std::mutex mutex; /* protects corrupt */
+    size_t checked; /* number of DataObjs read */
+    size_t unchecked; /* number of DataObjs without a usable checksum */
+};
+
+extern "C" {
+
+int msiArchiveVerify(msParam_t* archiveIn, msParam_t* reportOut, msParam_t* statusOut, ruleExecInfo_t* rei)
+{
+    int status;
+
+    /* Check input parameters. */
+    if (archiveIn->type == NULL || strcmp(archiveIn->type, STR_MS_T)) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    /* Parse input parameters. */
+    const char* archiveStr = parseMspForStr(archiveIn);
+    if (archiveStr == NULL) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    std::string archive = archiveStr;
+
+    Archive* a = Archive::open(rei->rsComm, archive, NULL);
+    if (a == NULL) {
+        status = SYS_TAR_OPEN_ERR;
+    }
+    else {
+        json_t* json;
+        char* str;
+
+        json = Verifier(a).verify();
+        status = json_is_true(json_object_get(json, "ok")) ? 0 : USER_CHKSUM_MISMATCH;
+        str = json_dumps(json, 0);
+        json_decref(json);
+        fillStrInMsParam(reportOut, str);
+        free(str);
+        delete a;
+    }
+
+    fillIntInMsParam(statusOut, status);
+    return status;
+}
+
+irods::ms_table_entry* plugin_factory()
+{
+    irods::ms_table_entry* msvc = new irods::ms_table_entry(3);
+
+    msvc->add_operation<msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*>(
+        "msiArchiveVerify",
+        std::function<int(msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*)>(msiArchiveVerify));
+
+    return msvc;
+}
+}
@@ -25,6 +25,7 @@
 #include "irods_ms_plugin.hpp"
 #include "irods/rcMisc.h"
 #include "irods/resource_administration.hpp"
+#include "ResourceInfo.hh"
 #include "rsFileStat.hpp"
 #include "rsGenQuery.hpp"
 
@@ -38,81 +39,6 @@
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
-/** Internal function to get an attribute of a resource, based on its name. */
-static int get_resource_attribute_by_name(rsComm_t* rsComm,
-                                          char* resource_name,
-                                          char* resource_value_out,
-                                          int column_number)
-{
-    genQueryInp_t genQueryInp;
-    genQueryOut_t* genQueryOut = NULL;
-    sqlResult_t* resource_data;
-    char equalsResourceName[MAX_NAME_LEN + 1];
-    memset(&genQueryInp, '\0', sizeof(genQueryInp_t));
-    memset(&equalsResourceName, '\0', MAX_NAME_LEN + 1);
-
-    snprintf(equalsResourceName, MAX_NAME_LEN + 1, "='%s'", resource_name);
-    addInxVal(&genQueryInp.sqlCondInp, COL_R_RESC_NAME, equalsResourceName);
-    addInxIval(&genQueryInp.selectInp, column_number, 1);
-
-    genQueryInp.maxRows = 1;
-    genQueryOut = NULL;
-    int status = rsGenQuery(rsComm, &genQueryInp, &genQueryOut);
-
-    int out_status = 0;
-
-    if (status >= 0) {
-        if (genQueryOut->rowCnt != 1) {
-            out_status = CAT_UNKNOWN_RESOURCE;
-        }
-        else {
-            if ((resource_data = getSqlResultByInx(genQueryOut, column_number)) == NULL) {
-                rodsLog(LOG_ERROR,
-                        "msi_dir_list: getSqlResultByInx for column %d failed on lookup of %s",
-                        column_number,
-                        resource_name);
-                out_status = UNMATCHED_KEY_OR_INDEX;
-            }
-            else {
-                strncpy(resource_value_out, resource_data->value, MAX_NAME_LEN + 1);
-                out_status = 0;
-            }
-        }
-    }
-    else {
-        out_status = status;
-    }
-
-    clearGenQueryInp(&genQueryInp);
-    freeGenQueryOut(&genQueryOut);
-
-    return out_status;
-}
-
-/** This function converts a resource name to a resource ID.
- *  The resource ID is written as char array to resource_id_out.
- */
-static int get_resource_id(rsComm_t* rsComm, char* resource_name, char* resource_id_out)
-{
-    return get_resource_attribute_by_name(rsComm, resource_name, resource_id_out, COL_R_RESC_ID);
-}
-
-/** This function retrieves the vault path of a resource based on its name
- *  to resource_id_out.
- */
-static int get_resource_vault_path(rsComm_t* rsComm, char* resource_name, char* resource_vault_path_out)
-{
-    return get_resource_attribute_by_name(rsComm, resource_name, resource_vault_path_out, COL_R_VAULT_PATH);
-}
-
-/** This function retrieves the location of a resource based on its name
- *  to resource_loc_out
- */
-static int get_resource_loc(rsComm_t* rsComm, char* resource_name, char* resource_loc_out)
-{
-    return get_resource_attribute_by_name(rsComm, resource_name, resource_loc_out, COL_R_LOC);
-}
-
 int msiDirList(msParam_t* _path, msParam_t* _rescName, msParam_t* _list, ruleExecInfo_t* _rei)
 {
     // Convert parameter values to C strings.
@@ -136,22 +62,18 @@ int msiDirList(msParam_t* _path, msParam_t* _rescName, msParam_t* _list, ruleExe
         return SYS_USER_NO_PERMISSION;
     }
 
-    // Look up resource ID of resource.
-    char resource_id_str[MAX_NAME_LEN];
-    memset(&resource_id_str, '\0', MAX_NAME_LEN);
-    int status_resource_id = get_resource_id(_rei->rsComm, rescName, resource_id_str);
+    // Look up the resource, usually from the cache.
+    ResourceInfo resource;
+    int status_resource = ResourceInfo::lookup(_rei->rsComm, rescName, resource);
 
     // Return error if resource does not exist
-    if (status_resource_id == CAT_NO_ROWS_FOUND) {
+    if (status_resource == CAT_UNKNOWN_RESOURCE) {
         rodsLog(LOG_ERROR, "msi_dir_list: could not find resource [%s]", rescName);
         return CAT_UNKNOWN_RESOURCE;
     }
-    else if (status_resource_id < 0) {
-        rodsLog(LOG_ERROR,
-                "msi_dir_list: error while looking up resource ID of resource [%s]: %d",
-                rescName,
-                status_resource_id);
-        return status_resource_id;
+    else if (status_resource < 0) {
+        rodsLog(LOG_ERROR, "msi_dir_list: error while looking up resource [%s]: %d", rescName, status_resource);
+        return status_resource;
     }
 
     fs::path physical_path_bp(path_str);
@@ -167,43 +89,17 @@ int msiDirList(msParam_t* _path, msParam_t* _rescName, msParam_t* _list, ruleExe
         return SYS_INVALID_FILE_PATH;
     }
 
-    // Retrieve resource vault path
-    char resource_vault_path[MAX_NAME_LEN + 1];
-    memset(&resource_vault_path, '\0', MAX_NAME_LEN + 1);
-    int status_resource_vault_path = get_resource_vault_path(_rei->rsComm, rescName, resource_vault_path);
-    if (status_resource_vault_path < 0) {
-        rodsLog(LOG_ERROR,
-                "msi_dir_list: error while looking up resource vault path of resource [%s]: %d",
-                rescName,
-                status_resource_vault_path);
-        return status_resource_vault_path;
-    }
-
     // Check that canonical physical path is in resource vault path. Return error if not.
     fs::path normalized_physical_path_bp = physical_path_bp.lexically_normal();
     const char* normalized_physical_path_str = normalized_physical_path_bp.c_str();
-    if (strncmp(normalized_physical_path_str, resource_vault_path, strlen(resource_vault_path)) ||
-        normalized_physical_path_str[strlen(resource_vault_path)] != '/')
-    {
+    if (!resource.inVault(normalized_physical_path_str)) {
         rodsLog(
             LOG_ERROR, "msi_dir_list: physical path is not inside resource vault for %s", normalized_physical_path_str);
         return SYS_INVALID_FILE_PATH;
     }
 
-    // Retrieve resource location
-    char resource_loc[MAX_NAME_LEN + 1];
-    memset(&resource_loc, '\0', MAX_NAME_LEN + 1);
-    int status_resource_loc = get_resource_loc(_rei->rsComm, rescName, resource_loc);
-    if (status_resource_loc < 0) {
-        rodsLog(LOG_ERROR,
-                "msi_dir_list: error while looking up resource vault path of resource [%s]: %d",
-                rescName,
-                status_resource_loc);
-        return status_resource_loc;
-    }
-
     // Check if the hostname and resource location are the same.
-    if (strcmp(_rei->rsComm->myEnv.rodsHost, resource_loc) != 0) {
+    if (resource.location != _rei->rsComm->myEnv.rodsHost) {
         rodsLog(LOG_ERROR, "msi_dir_list: hostname differs from resource location");
         return USER_INVALID_RESC_INPUT;
     }
@@ -22,68 +22,239 @@
  * If not, see <http://www.gnu.org/licenses/>.
  */
 #include "irods_includes.hh"
-#include "irods/SHA256Strategy.hpp"
-#include "irods/checksum.h"
 #include "irods_ms_plugin.hpp"
 #include "irods/rcMisc.h"
 #include "Archive.hh"
+#include "ChecksumCache.hh"
+#include "Digest.hh"
+#include "FileHasher.hh"
+#include "Options.hh"
+#include "RateLimiter.hh"
+#include "ResourceInfo.hh"
+#include "ThreadPool.hh"
 #include "irods/resource_administration.hpp"
 #include "rsFileStat.hpp"
 #include "rsGenQuery.hpp"
 
-#define IRODS_QUERY_ENABLE_SERVER_SIDE_API
-#include "irods/query_builder.hpp"
-
 #include <boost/filesystem.hpp>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string_view>
 #include <vector>
 #include <string>
 
-/** Internal function to get attributes of a resource, based on its name
- */
+#define CHECKSUM_QUEUE_SIZE     1
+#define CHECKSUM_THREADS        4
+#define CHECKSUM_MIN_CHUNK_SIZE (1024LL * 1024) // a multiple of A_HASHALIGN
+#define CHECKSUM_MAX_CHUNKS     65536LL         // per call, which bounds the size of the result
 
-static json_t* get_resource_info_by_name(RsComm& _comm, char* resource_name)
+/** Compute checksums of a local file in a single read pass. Reading overlaps with hashing, and with more than
+ *  one algorithm every algorithm hashes each block on a worker thread of its own. With direct I/O the file is
+ *  read around the page cache. Reads are charged to the budget of limiter, if not NULL.
+ */
+static int compute_checksums(const char* path,
+                             const std::vector<std::string>& algorithms,
+                             bool direct,
+                             RateLimiter* limiter,
+                             std::vector<std::string>& checksums)
 {
-    json_t* list;
-    const std::string qstr = std::string("SELECT RESC_ID, RESC_VAULT_PATH, RESC_LOC "
-                                         "WHERE RESC_NAME = '") +
-                             resource_name + "'";
+    std::vector<std::unique_ptr<Digest>> digests;
+    FileHasher hasher;
+    int status;
 
-    list = NULL;
+    if (algorithms.empty()) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    for (auto&& algorithm : algorithms) {
+        digests.push_back(std::unique_ptr<Digest>(new Digest(algorithm)));
+        if (!digests.back()->valid()) {
+            rodsLog(LOG_ERROR, "msi_file_checksum: unsupported checksum algorithm <%s>", algorithm.c_str());
+            return SYS_INVALID_INPUT_PARAM;
+        }
+    }
 
-    irods::experimental::query_builder qb;
-    auto q = qb.build<RsComm>(_comm, qstr);
-    if (q.empty()) {
-        THROW(CAT_UNKNOWN_RESOURCE, "msi_stat_vault: cannot find the resource.");
+    status = hasher.open(path, direct);
+    if (status < 0) {
+        return UNIX_FILE_OPEN_ERR + status;
+    }
+    hasher.limit(limiter);
+    if (digests.size() == 1) {
+        status = hasher.read([&digests](const char* buf, size_t len) { digests[0]->update(buf, len); });
     }
     else {
-        for (auto&& row : q) {
-            json_t* json;
+        ThreadPool pool(digests.size(), CHECKSUM_QUEUE_SIZE);
+
+        status = hasher.read([&digests, &pool](const char* buf, size_t len) {
+            for (size_t i = 0; i < digests.size(); i++) {
+                Digest* digest = digests[i].get();
+                pool.submit(i, [digest, buf, len] { digest->update(buf, len); });
+            }
+            pool.wait(); // the block is reused once this returns
+        });
+    }
+    if (status < 0) {
+        return UNIX_FILE_READ_ERR + status;
+    }
 
-            json = json_object();
+    checksums.clear();
+    for (auto&& digest : digests) {
+        checksums.push_back(digest->checksum());
+    }
 
-            json_object_set(json, "resc_id", json_string(row[0].c_str()));
-            json_object_set(json, "resc_vault_path", json_string(row[1].c_str()));
-            json_object_set(json, "resc_loc", json_string(row[2].c_str()));
+    return 0;
+}
 
-            if (list == NULL) {
-                list = json_array();
-            }
-            json_array_append(list, json);
-        }
+/** Compute checksums of a local file, or take them from the checksum cache of its resource. A cached checksum is
+ *  used if the file has not changed since, unless forced or verified more than max_age seconds ago (if not
+ *  negative). When a file that has not changed hashes differently from its cached checksums, the file is corrupt and
+ *  USER_CHKSUM_MISMATCH is returned; otherwise the cache is updated.
+ */
+static int compute_cached_checksums(const char* path,
+                                    const std::string& cache_dir,
+                                    const std::vector<std::string>& algorithms,
+                                    bool direct,
+                                    RateLimiter* limiter,
+                                    bool force,
+                                    long long max_age,
+                                    std::vector<std::string>& checksums)
+{
+    ChecksumCache cache(cache_dir);
+    std::vector<std::string> cached;
+    struct stat before, after;
+    time_t verified;
+    bool found;
+    int status;
+
+    if (stat(path, &before) < 0) {
+        return UNIX_FILE_STAT_ERR - errno;
+    }
+    found = cache.lookup(before, algorithms, cached, verified);
+    if (found && !force && (max_age < 0 || time(NULL) - verified <= max_age)) {
+        checksums = cached;
+        return 0;
     }
 
-    qb.clear();
+    status = compute_checksums(path, algorithms, direct, limiter, checksums);
+    if (status < 0) {
+        return status;
+    }
+    if (stat(path, &after) < 0 || !ChecksumCache::same(before, after)) {
+        return 0; // changed while hashing, not cached
+    }
+    if (found && cached != checksums) {
+        rodsLog(LOG_ERROR, "msi_file_checksum: checksum of unmodified file %s differs from cached checksum", path);
+        return USER_CHKSUM_MISMATCH;
+    }
+    if (cache.store(after, algorithms, checksums) < 0) {
+        rodsLog(LOG_NOTICE, "msi_file_checksum: cannot update checksum cache for %s", path);
+    }
 
-    return list;
+    return 0;
 }
 
-/** This function gets the resource attributes by its name. The result is stored into
- *  json_array.
+/** Compute checksums of fixed-size chunks of a local file in parallel. Only chunks first_chunk up to
+ *  first_chunk + chunk_count are hashed (all for a negative count), so that an interrupted scrub can be resumed and
+ *  a byte range can be verified again later. When all chunks are hashed, the root checksum is the digest of the
+ *  concatenated binary chunk digests. Every worker thread reads the chunks it takes through a reader of its own.
+ *  The chunk size must be at least CHECKSUM_MIN_CHUNK_SIZE and a multiple of A_HASHALIGN, so that chunks start at
+ *  aligned offsets for direct I/O, and at most CHECKSUM_MAX_CHUNKS chunks are hashed per call. The result is a JSON
+ *  object.
  */
-static json_t* get_resource_info(RsComm& _comm, char* resource_name)
+static int compute_chunk_checksums(const char* path,
+                                   const std::string& algorithm,
+                                   bool direct,
+                                   RateLimiter* limiter,
+                                   long long chunk_size,
+                                   long long first_chunk,
+                                   long long chunk_count,
+                                   size_t threads,
+                                   std::string& result)
 {
-    return get_resource_info_by_name(_comm, resource_name);
+    struct stat st;
+    json_t* json;
+    json_t* chunks;
+    char* str;
+
+    if (!Digest(algorithm).valid() || chunk_size < CHECKSUM_MIN_CHUNK_SIZE ||
+        chunk_size % (long long) A_HASHALIGN != 0 || first_chunk < 0)
+    {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    if (stat(path, &st) < 0) {
+        return UNIX_FILE_STAT_ERR - errno;
+    }
+    long long total = (st.st_size + chunk_size - 1) / chunk_size;
+    if (first_chunk > total) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    long long end = (chunk_count < 0 || chunk_count > total - first_chunk) ? total : first_chunk + chunk_count;
+    if (end - first_chunk > CHECKSUM_MAX_CHUNKS) {
+        rodsLog(LOG_ERROR,
+                "msi_file_checksum: at most %lld chunks can be hashed per call, use firstChunk and chunkCount",
+                CHECKSUM_MAX_CHUNKS);
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    std::vector<std::string> values((size_t) (end - first_chunk));
+    std::atomic<long long> next(first_chunk);
+    std::atomic<int> failure(0);
+    {
+        ThreadPool pool(threads, 1);
+
+        for (size_t i = 0; i < threads; i++) {
+            pool.submit(i, [&, path, direct] {
+                FileHasher hasher;
+                int status;
+
+                status = hasher.open(path, direct);
+                if (status < 0) {
+                    failure = UNIX_FILE_OPEN_ERR + status;
+                    return;
+                }
+                hasher.limit(limiter);
+                for (long long n = next++; n < end && failure == 0; n = next++) {
+                    Digest digest(algorithm);
+
+                    status = hasher.read([&digest](const char* buf, size_t len) { digest.update(buf, len); },
+                                         (off_t) (n * chunk_size),
+                                         (off_t) chunk_size);
+                    if (status < 0) {
+                        failure = UNIX_FILE_READ_ERR + status;
+                        return;
+                    }
+                    values[(size_t) (n - first_chunk)] = digest.value();
+                }
+            });
+        }
+        pool.wait();
+    }
+    if (failure != 0) {
+        return failure;
+    }
+
+    Digest root(algorithm);
+    chunks = json_array();
+    for (auto&& value : values) {
+        json_array_append_new(chunks, json_string(root.format(value).c_str()));
+        root.update(value.data(), value.length());
+    }
+    json = json_object();
+    json_object_set_new(json, "algorithm", json_string(algorithm.c_str()));
+    json_object_set_new(json, "size", json_integer((json_int_t) st.st_size));
+    json_object_set_new(json, "chunkSize", json_integer(chunk_size));
+    json_object_set_new(json, "firstChunk", json_integer(first_chunk));
+    json_object_set_new(json, "chunks", chunks);
+    if (first_chunk == 0 && end == total) {
+        json_object_set_new(json, "root", json_string(root.checksum().c_str()));
+    }
+    str = json_dumps(json, JSON_COMPACT);
+    json_decref(json);
+    result = str;
+    free(str);
+
+    return 0;
 }
 
 int msiFileChecksum(msParam_t* _physical_path_name,
@@ -97,7 +268,24 @@ int msiFileChecksum(msParam_t* _physical_path_name,
         return SYS_INVALID_INPUT_PARAM;
     }
 
-    char* resource_name_str = parseMspForStr(_resource_name);
+    // The second parameter is either the name of the resource, or a list of options:
+    //   resource:     name of the resource
+    //   algorithms:   comma separated list of md5, sha1, sha256, sha512 and adler32; the checksums are
+    //                 computed in one pass and returned as a JSON object
+    //   direct:       read the file with direct I/O, so that it does not evict the page cache
+    //   chunkSize:    hash chunks of this many bytes in parallel, with one algorithm, and return the chunk checksums
+    //                 and the root checksum over them as a JSON object; at least 1 MiB and a multiple of 4 KiB
+    //   firstChunk:   first chunk to hash, default 0
+    //   chunkCount:   number of chunks to hash, default all; at most 65536 per call
+    //   threads:      number of chunks hashed at the same time, default 4
+    //   cache:        take the checksums from the checksum cache of the resource if the file has not changed since,
+    //                 and update the cache
+    //   force:        with cache, always read the file
+    //   maxAge:       with cache, read the file if its cached checksums were computed more than this many seconds ago
+    //   maxBandwidth: read at most this many MiB per second, together with all other calls on this server
+    //   maxIops:      issue at most this many reads per second, together with all other calls on this server
+    Options options(_resource_name, "resource");
+    char* resource_name_str = (char*) options.get("resource");
     if (!resource_name_str) {
         return SYS_INVALID_INPUT_PARAM;
     }
@@ -113,56 +301,37 @@ int msiFileChecksum(msParam_t* _physical_path_name,
         return SYS_INVALID_FILE_PATH;
     }
 
-    json_t* list = NULL;
-    size_t i;
-
-    char resource_id_str[MAX_NAME_LEN];
-    memset(&resource_id_str, '\0', MAX_NAME_LEN);
-
-    char resource_vault_path[MAX_NAME_LEN + 1];
-    memset(&resource_vault_path, '\0', MAX_NAME_LEN + 1);
-
-    char resource_loc[MAX_NAME_LEN + 1];
-    memset(&resource_loc, '\0', MAX_NAME_LEN + 1);
-
-    list = get_resource_info(*_rei->rsComm, resource_name_str);
-
-    for (i = 0; i < json_array_size(list); i++) {
-        json_t* json;
-
-        json = json_object();
-        json = json_array_get(list, i);
-        strcpy(resource_id_str, json_string_value(json_object_get(json, "resc_id")));
-        strcpy(resource_vault_path, json_string_value(json_object_get(json, "resc_vault_path")));
-        strcpy(resource_loc, json_string_value(json_object_get(json, "resc_loc")));
-    }
-
-    // Convert resource ID C string to long value
-    char* end_resource_id_str = end_resource_id_str;
-    long resource_id = strtol(resource_id_str, &end_resource_id_str, 10);
-    if (*end_resource_id_str != '\0') {
-        rodsLog(LOG_ERROR, "msi_file_checksum: failed to convert resource ID %s to long value.", resource_id_str);
-        return CAT_UNKNOWN_RESOURCE;
+    // Look up the resource, usually from the cache.
+    ResourceInfo resource;
+    int status_resource = ResourceInfo::lookup(_rei->rsComm, resource_name_str, resource);
+    if (status_resource < 0) {
+        rodsLog(LOG_ERROR, "msi_file_checksum: cannot find resource %s (%d)", resource_name_str, status_resource);
+        return status_resource;
     }
 
     // Check that canonical physical path is in resource vault path. Return error if not.
     boost::filesystem::path physical_path_bp(physical_path_str);
     boost::filesystem::path normalized_physical_path_bp = physical_path_bp.lexically_normal();
     const char* normalized_physical_path_str = normalized_physical_path_bp.c_str();
-    if (strncmp(normalized_physical_path_str, resource_vault_path, strlen(resource_vault_path)) ||
-        normalized_physical_path_str[strlen(resource_vault_path)] != '/')
-    {
+    if (!resource.inVault(normalized_physical_path_str)) {
         rodsLog(LOG_ERROR,
                 "msi_file_checksum: physical path is not inside resource vault for %s",
                 normalized_physical_path_str);
         return SYS_INVALID_FILE_PATH;
     }
 
+    // Optional I/O budget, shared by all agents on this server.
+    std::unique_ptr<RateLimiter> limiter;
+    if (options.integer("maxBandwidth", 0) > 0 || options.integer("maxIops", 0) > 0) {
+        limiter.reset(
+            new RateLimiter(options.integer("maxBandwidth", 0) * 1024 * 1024, options.integer("maxIops", 0)));
+    }
+
     // Call rsFileStat to determine size and type
     fileStatInp_t fileStatInp;
     rodsStat_t* fileStatOut = NULL;
     rstrcpy(fileStatInp.fileName, normalized_physical_path_str, sizeof(fileStatInp.fileName));
-    fileStatInp.rescId = resource_id;
+    fileStatInp.rescId = resource.id;
     const int status_rsFileStat = rsFileStat(_rei->rsComm, &fileStatInp, &fileStatOut);
 
     if (status_rsFileStat == -516002) {
@@ -172,22 +341,81 @@ int msiFileChecksum(msParam_t* _physical_path_name,
         rodsLog(LOG_ERROR,
                 "msi_file_checksum: unexpected error during rsFileStat of path %s in resource %s (%d)",
                 physical_path_str,
-                resource_id,
+                resource_name_str,
                 status_rsFileStat);
         return status_rsFileStat;
     }
     else {
         // If the hostname and resource location is same, then
-        // compute SHA256 checksum of file.
-        if (strcmp(_rei->rsComm->myEnv.rodsHost, resource_loc) == 0) {
-            char checksum[NAME_LEN];
-            _rei->status = chksumLocFile(physical_path_str, checksum, irods::SHA256_NAME.c_str());
+        // compute SHA256 checksum of file, or the requested checksums.
+        if (resource.location == _rei->rsComm->myEnv.rodsHost && options.get("chunkSize") != NULL) {
+            std::vector<std::string> algorithms = options.list("algorithms");
+            std::string checksums;
+
+            if (algorithms.size() > 1) {
+                rodsLog(LOG_ERROR, "msi_file_checksum: chunked checksums take a single algorithm");
+                return SYS_INVALID_INPUT_PARAM;
+            }
+            long long threads = std::min(std::max(options.integer("threads", CHECKSUM_THREADS), 1LL), 64LL);
+            _rei->status = compute_chunk_checksums(physical_path_str,
+                                                   algorithms.empty() ? "sha256" : algorithms[0],
+                                                   options.flag("direct"),
+                                                   limiter.get(),
+                                                   options.integer("chunkSize", 0),
+                                                   options.integer("firstChunk", 0),
+                                                   options.integer("chunkCount", -1),
+                                                   (size_t) threads,
+                                                   checksums);
+
+            if (_rei->status < 0) {
+                rodsLog(LOG_ERROR,
+                        "msi_file_checksum: failed to calculate chunk checksums for file: %s",
+                        physical_path_str);
+            }
+            else {
+                fillStrInMsParam(_checksum, checksums.c_str());
+            }
+
+            return _rei->status;
+        }
+        else if (resource.location == _rei->rsComm->myEnv.rodsHost) {
+            std::vector<std::string> algorithms = options.list("algorithms");
+            std::vector<std::string> checksums;
+            bool map = !algorithms.empty();
+
+            if (!map) {
+                algorithms.push_back("sha256");
+            }
+            if (options.flag("cache")) {
+                _rei->status = compute_cached_checksums(physical_path_str,
+                                                        std::string(A_CACHEROOT "/") + std::to_string(resource.id),
+                                                        algorithms,
+                                                        options.flag("direct"),
+                                                        limiter.get(),
+                                                        options.flag("force"),
+                                                        options.integer("maxAge", -1),
+                                                        checksums);
+            }
+            else {
+                _rei->status =
+                    compute_checksums(physical_path_str, algorithms, options.flag("direct"), limiter.get(), checksums);
+            }
 
             if (_rei->status < 0) {
                 rodsLog(LOG_ERROR, "msi_file_checksum: failed to calculate checksum for file: %s", physical_path_str);
             }
+            else if (map) {
+                json_t* json = json_object();
+                for (size_t i = 0; i < algorithms.size(); i++) {
+                    json_object_set_new(json, algorithms[i].c_str(), json_string(checksums[i].c_str()));
+                }
+                char* str = json_dumps(json, JSON_COMPACT);
+                json_decref(json);
+                fillStrInMsParam(_checksum, str);
+                free(str);
+            }
             else {
-                fillStrInMsParam(_checksum, checksum);
+                fillStrInMsParam(_checksum, checksums[0].c_str());
             }
 
             return _rei->status;
@@ -207,6 +435,11 @@ extern "C" irods::ms_table_entry* plugin_factory()
 {
     irods::ms_table_entry* msvc = new irods::ms_table_entry(3);
 
+    // Look up the SHA-256 implementation once, when the plugin is loaded.
+    if (Digest::implementation("sha256") != NULL) {
+        rodsLog(LOG_DEBUG, "msi_file_checksum: SHA-256 acceleration: %s", Digest::acceleration());
+    }
+
     msvc->add_operation<msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*>(
         "msiFileChecksum", std::function<int(msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*)>(msiFileChecksum));
     return msvc;
@@ -0,0 +1,480 @@
+/**
+ * \file
+ * \brief     iRODS microservice to compute checksums of many physical files on a resource
+ * \copyright Copyright (c) 2026, Utrecht University
+ *
+ * This file is part of irods-uu-microservices.
+ *
+ * irods-uu-microservices is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * irods-uu-microservices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with irods-uu-microservices.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "irods_includes.hh"
+#include "irods_ms_plugin.hpp"
+#include "jansson.h"
+#include "Digest.hh"
+#include "FileHasher.hh"
+#include "Options.hh"
+#include "RateLimiter.hh"
+#include "ResourceInfo.hh"
+#include "ThreadPool.hh"
+#include "rsDataObjClose.hpp"
+#include "rsDataObjCreate.hpp"
+#include "rsDataObjOpen.hpp"
+#include "rsDataObjRead.hpp"
+#include "rsDataObjWrite.hpp"
+
+#include <boost/filesystem.hpp>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define CHECKSUM_THREADS     4
+#define CHECKSUM_MAX_THREADS 64                // each thread has its own read buffers
+#define CHECKSUM_MAX_RESULTS 10000             // results returned as a string; more need an output data object
+#define CHECKSUM_WINDOW      1024              // paths hashed before their results are written
+#define CHECKSUM_IO_SIZE     (4 * 1024 * 1024) // read and write size of the manifest and output
+
+/** Result of hashing one physical file.
+ */
+struct checksum_result
+{
+    std::string path;                   // physical path as given
+    long long size;                     // size of the file, or -1
+    std::vector<std::string> checksums; // one per algorithm
+    std::string error;                  // empty on success
+};
+
+/** Hash one physical file with every algorithm. This runs on a worker thread and must not call iRODS.
+ */
+static void hash_file(checksum_result& result,
+                      const std::vector<std::string>& algorithms,
+                      bool direct,
+                      RateLimiter* limiter)
+{
+    thread_local FileHasher hasher;
+    std::vector<std::unique_ptr<Digest>> digests;
+    int status;
+
+    status = hasher.open(result.path.c_str(), direct, O_NOFOLLOW);
+    if (status < 0) {
+        result.error = strerror(-status);
+        return;
+    }
+    hasher.limit(limiter);
+    if (!S_ISREG(hasher.status().st_mode)) {
+        result.error = "not a regular file";
+        hasher.close();
+        return;
+    }
+
+    for (auto&& algorithm : algorithms) {
+        digests.push_back(std::unique_ptr<Digest>(new Digest(algorithm)));
+    }
+    status = hasher.read([&digests](const char* buf, size_t len) {
+        for (auto&& digest : digests) {
+            digest->update(buf, len);
+        }
+    });
+    hasher.close();
+    if (status < 0) {
+        result.error = strerror(-status);
+        return;
+    }
+
+    result.size = (long long) hasher.status().st_size;
+    for (auto&& digest : digests) {
+        result.checksums.push_back(digest->checksum());
+    }
+}
+
+/** Convert a result to a line of JSON.
+ */
+static std::string result_line(const checksum_result& result, const std::vector<std::string>& algorithms, bool map)
+{
+    json_t* json;
+    json_t* checksums;
+    char* str;
+
+    json = json_object();
+    json_object_set_new(json, "path", json_string(result.path.c_str()));
+    if (result.error.empty()) {
+        json_object_set_new(json, "size", json_integer(result.size));
+        if (map) {
+            checksums = json_object();
+            for (size_t i = 0; i < algorithms.size(); i++) {
+                json_object_set_new(checksums, algorithms[i].c_str(), json_string(result.checksums[i].c_str()));
+            }
+            json_object_set_new(json, "checksums", checksums);
+        }
+        else {
+            json_object_set_new(json, "checksum", json_string(result.checksums[0].c_str()));
+        }
+    }
+    else {
+        json_object_set_new(json, "error", json_string(result.error.c_str()));
+    }
+    str = json_dumps(json, JSON_COMPACT);
+    json_decref(json);
+
+    std::string line = str;
+    free(str);
+    return line + "\n";
+}
+
+/** Destination of the JSON lines: a data object, written in large blocks, or a string.
+ */
+class result_output
+{
+  public:
+    result_output(RsComm* _comm)
+        : comm(_comm)
+        , fd(-1)
+    {
+    }
+
+    ~result_output()
+    {
+        if (fd >= 0) {
+            close_object();
+        }
+    }
+
+    // create or truncate the data object to write to, return status
+    int create(const char* path, const char* resource)
+    {
+        dataObjInp_t create;
+
+        // no forceFlag with create, see https://github.com/irods/irods/issues/4692
+        memset(&create, '\0', sizeof(dataObjInp_t));
+        create.openFlags = O_WRONLY | O_TRUNC;
+        if (resource != NULL) {
+            addKeyVal(&create.condInput, DEST_RESC_NAME_KW, resource);
+        }
+        rstrcpy(create.objPath, path, MAX_NAME_LEN);
+        fd = rsDataObjOpen(comm, &create);
+        if (fd == OBJ_PATH_DOES_NOT_EXIST) {
+            create.openFlags = O_CREAT | O_WRONLY;
+            fd = rsDataObjCreate(comm, &create);
+        }
+        clearKeyVal(&create.condInput);
+        return (fd < 0) ? fd : 0;
+    }
+
+    // add a line, return status
+    int add(const std::string& line)
+    {
+        text += line;
+        return (fd >= 0 && text.length() >= CHECKSUM_IO_SIZE) ? flush() : 0;
+    }
+
+    // finish writing, return status
+    int finish()
+    {
+        int status;
+
+        if (fd < 0) {
+            return 0;
+        }
+        status = flush();
+        if (status < 0) {
+            return status;
+        }
+        return close_object();
+    }
+
+    std::string text; // lines not yet written, or all lines without a data object
+
+  private:
+    int flush()
+    {
+        openedDataObjInp_t input;
+        bytesBuf_t wbuf;
+        int status;
+
+        if (text.empty()) {
+            return 0;
+        }
+        memset(&input, '\0', sizeof(openedDataObjInp_t));
+        input.l1descInx = fd;
+        input.len = (int) text.length();
+        wbuf.buf = (void*) text.data();
+        wbuf.len = (int) text.length();
+        status = rsDataObjWrite(comm, &input, &wbuf);
+        if (status < 0) {
+            return status;
+        }
+        text.clear();
+        return 0;
+    }
+
+    int close_object()
+    {
+        openedDataObjInp_t input;
+
+        memset(&input, '\0', sizeof(openedDataObjInp_t));
+        input.l1descInx = fd;
+        fd = -1;
+        return rsDataObjClose(comm, &input);
+    }
+
+    RsComm* comm; // iRODS context
+    int fd;       // data object to write to, or -1
+};
+
+/** Read a manifest data object with one physical path per line, return status.
+ */
+static int read_manifest(RsComm* _comm, const char* manifest, std::vector<std::string>& paths)
+{
+    dataObjInp_t open;
+    openedDataObjInp_t input;
+    bytesBuf_t rbuf;
+    std::vector<char> buf(CHECKSUM_IO_SIZE);
+    std::string partial;
+    int fd, len;
+
+    memset(&open, '\0', sizeof(dataObjInp_t));
+    open.openFlags = O_RDONLY;
+    rstrcpy(open.objPath, manifest, MAX_NAME_LEN);
+    fd = rsDataObjOpen(_comm, &open);
+    if (fd < 0) {
+        return fd;
+    }
+    for (;;) {
+        memset(&input, '\0', sizeof(openedDataObjInp_t));
+        input.l1descInx = fd;
+        input.len = (int) buf.size();
+        rbuf.buf = buf.data();
+        rbuf.len = (int) buf.size();
+        len = rsDataObjRead(_comm, &input, &rbuf);
+        if (len <= 0) {
+            break;
+        }
+        for (int i = 0; i < len; i++) {
+            if (buf[i] == '\n') {
+                if (!partial.empty()) {
+                    paths.push_back(partial);
+                }
+                partial.clear();
+            }
+            else if (buf[i] != '\r') {
+                partial += buf[i];
+            }
+        }
+    }
+    if (!partial.empty()) {
+        paths.push_back(partial);
+    }
+    memset(&input, '\0', sizeof(openedDataObjInp_t));
+    input.l1descInx = fd;
+    rsDataObjClose(_comm, &input);
+
+    return (len < 0) ? len : 0;
+}
+
+int msiFileChecksumBatch(msParam_t* _physical_paths, msParam_t* _options, msParam_t* _results, ruleExecInfo_t* _rei)
+{
+    // The second parameter is either the name of the resource, or a list of options:
+    //   resource:       name of the resource that holds the files
+    //   manifest:       data object with one physical path per line, instead of the first parameter
+    //   algorithms:     comma separated list of md5, sha1, sha256, sha512 and adler32, default sha256
+    //   threads:        number of files hashed at the same time, default 4, at most 64
+    //   output:         data object to write the results to, instead of returning them; required for more
+    //                   than 10000 paths, since returned results are held in memory
+    //   outputResource: resource to create the output data object on
+    //   direct:         read the files with direct I/O, so that they do not evict the page cache
+    //   maxBandwidth:   read at most this many MiB per second, together with all other calls on this server
+    //   maxIops:        issue at most this many reads per second, together with all other calls on this server
+    Options options(_options, "resource");
+    const char* resource_name = options.get("resource");
+    if (resource_name == NULL) {
+        return SYS_INVALID_INPUT_PARAM;
+    }
+
+    // Check that user is rodsadmin.
+    if (_rei->uoic->authInfo.authFlag < LOCAL_PRIV_USER_AUTH) {
+        return SYS_USER_NO_PERMISSION;
+    }
+
+    // The physical paths are a JSON array, or one path per line.
+    std::vector<std::string> paths;
+    if (options.get("manifest") != NULL) {
+        int status = read_manifest(_rei->rsComm, options.get("manifest"), paths);
+        if (status < 0) {
+            rodsLog(LOG_ERROR, "msi_file_checksum_batch: cannot read manifest %s", options.get("manifest"));
+            return status;
+        }
+    }
+    else {
+        const char* paths_str = parseMspForStr(_physical_paths);
+        if (paths_str == NULL) {
+            return SYS_INVALID_INPUT_PARAM;
+        }
+        if (paths_str[0] == '[') {
+            json_t* json = json_loads(paths_str, 0, NULL);
+            json_t* path;
+            size_t i;
+
+            if (!json_is_array(json)) {
+                json_decref(json);
+                return SYS_INVALID_INPUT_PARAM;
+            }
+            json_array_foreach(json, i, path)
+            {
+                if (json_is_string(path)) {
+                    paths.push_back(json_string_value(path));
+                }
+            }
+            json_decref(json);
+        }
+        else {
+            for (const char* line = paths_str; *line != '\0';) {
+                size_t len = strcspn(line, "\r\n");
+                if (len != 0) {
+                    paths.push_back(std::string(line, len));
+                }
+                line += len;
+                line += strspn(line, "\r\n");
+            }
+        }
+    }
+
+    std::vector<std::string> algorithms = options.list("algorithms");
+    bool map = !algorithms.empty();
+    bool direct = options.flag("direct");
+
+    // Optional I/O budget, shared by all agents on this server.
+    std::unique_ptr<RateLimiter> limiter;
+    if (options.integer("maxBandwidth", 0) > 0 || options.integer("maxIops", 0) > 0) {
+        limiter.reset(
+            new RateLimiter(options.integer("maxBandwidth", 0) * 1024 * 1024, options.integer("maxIops", 0)));
+    }
+    if (algorithms.empty()) {
+        algorithms.push_back("sha256");
+    }
+    for (auto&& algorithm : algorithms) {
+        if (!Digest(algorithm).valid()) {
+            rodsLog(LOG_ERROR, "msi_file_checksum_batch: unsupported checksum algorithm <%s>", algorithm.c_str());
+            return SYS_INVALID_INPUT_PARAM;
+        }
+    }
+
+    // Look up the resource once for the whole batch.
+    ResourceInfo resource;
+    int status = ResourceInfo::lookup(_rei->rsComm, resource_name, resource);
+    if (status < 0) {
+        rodsLog(LOG_ERROR, "msi_file_checksum_batch: cannot find resource %s", resource_name);
+        return status;
+    }
+    if (resource.location != _rei->rsComm->myEnv.rodsHost) {
+        rodsLog(LOG_ERROR,
+                "msi_file_checksum_batch: failed to calculate checksums as hostname is different from location of "
+                "the given resource.");
+        return USER_INVALID_RESC_INPUT;
+    }
+
+    result_output output(_rei->rsComm);
+    if (options.get("output") == NULL && paths.size() > CHECKSUM_MAX_RESULTS) {
+        rodsLog(LOG_ERROR,
+                "msi_file_checksum_batch: %zu paths, the results of more than %d must be written to an output data "
+                "object",
+                paths.size(),
+                CHECKSUM_MAX_RESULTS);
+        return SYS_INVALID_INPUT_PARAM;
+    }
+    if (options.get("output") != NULL) {
+        status = output.create(options.get("output"), options.get("outputResource"));
+        if (status < 0) {
+            rodsLog(LOG_ERROR, "msi_file_checksum_batch: cannot create %s", options.get("output"));
+            return status;
+        }
+    }
+
+    // Hash a window of files on the workers, then write their results in order. Every worker takes the next
+    // file that is not yet taken, so that a large file does not hold up the files behind it.
+    size_t threads =
+        (size_t) std::min(std::max(options.integer("threads", CHECKSUM_THREADS), 1LL), (long long) CHECKSUM_MAX_THREADS);
+    ThreadPool pool(threads, 1);
+    std::vector<checksum_result> results;
+    for (size_t start = 0; start < paths.size() && status == 0; start += CHECKSUM_WINDOW) {
+        size_t end = std::min(paths.size(), start + CHECKSUM_WINDOW);
+        std::atomic<size_t> next(0);
+
+        results.assign(end - start, checksum_result());
+        for (size_t i = start; i < end; i++) {
+            checksum_result& result = results[i - start];
+
+            result.path = paths[i];
+            result.size = -1;
+
+            // Check that canonical physical path is in resource vault path.
+            std::string normalized = boost::filesystem::path(paths[i]).lexically_normal().string();
+            if (!resource.inVault(normalized)) {
+                result.error = "physical path is not inside resource vault";
+            }
+        }
+        for (size_t i = 0; i < threads; i++) {
+            pool.submit(i, [&results, &next, &algorithms, direct, &limiter] {
+                for (size_t n = next++; n < results.size(); n = next++) {
+                    if (results[n].error.empty()) {
+                        hash_file(results[n], algorithms, direct, limiter.get());
+                    }
+                }
+            });
+        }
+        pool.wait();
+
+        for (auto&& result : results) {
+            status = output.add(result_line(result, algorithms, map));
+            if (status < 0) {
+                break;
+            }
+        }
+    }
+    if (status == 0) {
+        status = output.finish();
+    }
+    if (status < 0) {
+        rodsLog(LOG_ERROR, "msi_file_checksum_batch: failed to write results");
+        return status;
+    }
+
+    if (options.get("output") == NULL) {
+        fillStrInMsParam(_results, output.text.c_str());
+    }
+    else {
+        fillStrInMsParam(_results, "");
+    }
+    return 0;
+}
+
+extern "C" irods::ms_table_entry* plugin_factory()
+{
+    irods::ms_table_entry* msvc = new irods::ms_table_entry(3);
+
+    // Look up the SHA-256 implementation once, when the plugin is loaded.
+    if (Digest::implementation("sha256") != NULL) {
+        rodsLog(LOG_DEBUG, "msi_file_checksum_batch: SHA-256 acceleration: %s", Digest::acceleration());
+    }
+
+    msvc->add_operation<msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*>(
+        "msiFileChecksumBatch",
+        std::function<int(msParam_t*, msParam_t*, msParam_t*, ruleExecInfo_t*)>(msiFileChecksumBatch));
+    return msvc;
+}
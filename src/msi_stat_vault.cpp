@@ -53,65 +53,16 @@
 #include "irods/rcMisc.h"
 #include "irods/resource_administration.hpp"
 #include "Archive.hh"
+#include "ResourceInfo.hh"
 #include "rsFileStat.hpp"
 #include "rsGenQuery.hpp"
 
-#define IRODS_QUERY_ENABLE_SERVER_SIDE_API
-#include "irods/query_builder.hpp"
-
 #include <irods/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
 #include <string_view>
 #include <vector>
 #include <string>
 
-/** Internal function to get attributes of a resource, based on its name
- */
-
-static json_t* get_resource_info_by_name(RsComm& _comm, char* resource_name)
-{
-    json_t* list;
-    const std::string qstr = std::string("SELECT RESC_ID, RESC_TYPE_NAME, RESC_VAULT_PATH "
-                                         "WHERE RESC_NAME = '") +
-                             resource_name + "'";
-
-    list = NULL;
-
-    irods::experimental::query_builder qb;
-    auto q = qb.build<RsComm>(_comm, qstr);
-    if (q.empty()) {
-        THROW(CAT_UNKNOWN_RESOURCE, "msi_stat_vault: cannot find the resource.");
-    }
-    else {
-        for (auto&& row : q) {
-            json_t* json;
-
-            json = json_object();
-
-            json_object_set(json, "resc_id", json_string(row[0].c_str()));
-            json_object_set(json, "resc_type", json_string(row[1].c_str()));
-            json_object_set(json, "resc_vault_path", json_string(row[2].c_str()));
-
-            if (list == NULL) {
-                list = json_array();
-            }
-            json_array_append(list, json);
-        }
-    }
-
-    qb.clear();
-
-    return list;
-}
-
-/** This function gets the resource attributes by its name. The result is stored into
- *  json_array.
- */
-static json_t* get_resource_info(RsComm& _comm, char* resource_name)
-{
-    return get_resource_info_by_name(_comm, resource_name);
-}
-
 int msiStatVault(msParam_t* _resource_name,
                  msParam_t* _physical_path_name,
                  msParam_t* _type,
@@ -144,38 +95,15 @@ int msiStatVault(msParam_t* _resource_name,
         return SYS_USER_NO_PERMISSION;
     }
 
-    json_t* list = NULL;
-    size_t i;
-    char resource_id_str[MAX_NAME_LEN];
-    memset(&resource_id_str, '\0', MAX_NAME_LEN);
-
-    char resource_type[MAX_NAME_LEN];
-    memset(&resource_type, '\0', MAX_NAME_LEN);
-
-    char resource_vault_path[MAX_NAME_LEN + 1];
-    memset(&resource_vault_path, '\0', MAX_NAME_LEN + 1);
-
-    list = get_resource_info(*_rei->rsComm, resource_name_str);
-
-    for (i = 0; i < json_array_size(list); i++) {
-        json_t* json;
-
-        json = json_object();
-        json = json_array_get(list, i);
-        strcpy(resource_id_str, json_string_value(json_object_get(json, "resc_id")));
-        strcpy(resource_type, json_string_value(json_object_get(json, "resc_type")));
-        strcpy(resource_vault_path, json_string_value(json_object_get(json, "resc_vault_path")));
-    }
-
-    // Convert resource ID C string to long value
-    char* end_resource_id_str = end_resource_id_str;
-    long resource_id = strtol(resource_id_str, &end_resource_id_str, 10);
-    if (*end_resource_id_str != '\0') {
-        rodsLog(LOG_ERROR, "msi_stat_vault: failed to convert resource ID %s to long value.", resource_id_str);
-        return CAT_UNKNOWN_RESOURCE;
+    // Look up the resource, usually from the cache.
+    ResourceInfo resource;
+    int status_resource = ResourceInfo::lookup(_rei->rsComm, resource_name_str, resource);
+    if (status_resource < 0) {
+        rodsLog(LOG_ERROR, "msi_stat_vault: cannot find resource %s (%d)", resource_name_str, status_resource);
+        return status_resource;
     }
 
-    if (strcmp("unixfilesystem", resource_type) != 0 and strcmp("unix file system", resource_type) != 0) {
+    if (resource.type != "unixfilesystem" && resource.type != "unix file system") {
         rodsLog(LOG_ERROR,
                 "msi_stat_vault: unable to stat files on resource %s. Not a unixfilesystem resource",
                 resource_name_str);
@@ -186,9 +114,7 @@ int msiStatVault(msParam_t* _resource_name,
     boost::filesystem::path physical_path_bp(physical_path_str);
     boost::filesystem::path normalized_physical_path_bp = physical_path_bp.lexically_normal();
     const char* normalized_physical_path_str = normalized_physical_path_bp.c_str();
-    if (strncmp(normalized_physical_path_str, resource_vault_path, strlen(resource_vault_path)) ||
-        normalized_physical_path_str[strlen(resource_vault_path)] != '/')
-    {
+    if (!resource.inVault(normalized_physical_path_str)) {
         rodsLog(LOG_ERROR,
                 "msi_stat_vault: physical path is not inside resource vault for %s",
                 normalized_physical_path_str);
@@ -199,7 +125,7 @@ int msiStatVault(msParam_t* _resource_name,
     fileStatInp_t fileStatInp;
     rodsStat_t* fileStatOut = NULL;
     rstrcpy(fileStatInp.fileName, normalized_physical_path_str, sizeof(fileStatInp.fileName));
-    fileStatInp.rescId = resource_id;
+    fileStatInp.rescId = resource.id;
     const int status_rsFileStat = rsFileStat(_rei->rsComm, &fileStatInp, &fileStatOut);
 
     // Convert fileStatOut and rsFileStat status to string parameters for type and size
@@ -0,0 +1,28 @@
+# Call with
+# irule -F msi_archive_append_test.r
+# Or call specifically with: 
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_append_test.r
+
+testArchiveAppend {
+    *sourceCollection = "/nlmumc/home/rods/test-data-collection";
+    *archiveTargetPath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *status = 0;
+    # Create the archive with room for the index to grow
+    msiString2KeyValPair("indexReserve=1048576", *options);
+    msiArchiveCreate(*archiveTargetPath, *sourceCollection, *options, *status);
+
+    # Add new and modified DataObjs of the source collection
+    if (*status == 0) {
+        msiString2KeyValPair("append=1", *options);
+        msiArchiveCreate(*archiveTargetPath, *sourceCollection, *options, *status);
+    }
+
+    # Error logging
+    if (*status != 0) {
+        writeLine("stdout", "Archive append failed with status: *status");
+    } else {
+        writeLine("stdout", "Archive appended successfully at *archiveTargetPath");
+    }
+}
+INPUT null
+OUTPUT ruleExecOut
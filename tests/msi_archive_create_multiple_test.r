@@ -0,0 +1,21 @@
+# Call with
+# irule -F msi_archive_create_multiple_test.r
+# Or call specifically with: 
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_create_multiple_test.r
+
+testArchiveCreateMultiple {
+    *sources = '["/nlmumc/home/rods/test-data-collection", "/nlmumc/home/rods/other-collection", "/nlmumc/home/rods/notes.txt"]';
+    *archiveTargetPath = "/nlmumc/home/rods/msi_archive_backup/multiple.tar";
+    *status = 0;
+    # Target path, JSON array of collections and DataObjs
+    msiArchiveCreate(*archiveTargetPath, *sources, "", *status);
+
+    # Error logging
+    if (*status != 0) {
+        writeLine("stdout", "Archive creation failed with status: *status");
+    } else {
+        writeLine("stdout", "Archive created successfully at *archiveTargetPath");
+    }
+}
+INPUT null
+OUTPUT ruleExecOut
@@ -0,0 +1,25 @@
+# Call with
+# irule -F msi_archive_extract_staging_test.r
+# Or call specifically with: 
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_extract_staging_test.r
+#
+# Requires rodsadmin, and "archive_staging_roots": "/scratch/staging" in
+# the credentials store.
+
+testArchiveExtractStaging {
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *stagingPath = "/scratch/staging/test-data-collection";
+    *status = 0;
+    # Write the members to a local directory, verifying their checksums
+    msiString2KeyValPair("staging=1++++verify=1", *options);
+    msiArchiveExtract(*archivePath, *stagingPath, "null", *options, *status);
+
+    # Error logging
+    if (*status != 0) {
+        writeLine("stdout", "Archive staging failed with status: *status");
+    } else {
+        writeLine("stdout", "Archive staged successfully at *stagingPath");
+    }
+}
+INPUT null
+OUTPUT ruleExecOut
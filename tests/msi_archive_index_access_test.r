@@ -0,0 +1,58 @@
+# Call with
+# irule -F msi_archive_index_access_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_index_access_test.r
+#
+# Checks that the cached index of an archive is not handed out to a user
+# who cannot read the archive, and is handed out to a user whose access
+# level includes reading. The access of the user to the archive is changed
+# temporarily, and restored in admin mode.
+
+testArchiveIndexAccess {
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *user = $userNameClient;
+    *failed = 0;
+
+    # Fill the index cache
+    msiArchiveIndex(*archivePath, *index);
+
+    msiSetACL("default", "null", *user, *archivePath);
+    *ec = errorcode(msiArchiveIndex(*archivePath, *index));
+    if (*ec >= 0) {
+        writeLine("stdout", "msiArchiveIndex returned the index without read access");
+        *failed = *failed + 1;
+    }
+    *ec = errorcode(msiArchiveIndexQuery(*archivePath, 0, 10, "", "name", *index));
+    if (*ec >= 0) {
+        writeLine("stdout", "msiArchiveIndexQuery returned the index without read access");
+        *failed = *failed + 1;
+    }
+    *ec = errorcode(msiArchiveReadMember(*archivePath, "README.txt", 0, 0, *buf));
+    if (*ec >= 0) {
+        writeLine("stdout", "msiArchiveReadMember returned a member without read access");
+        *failed = *failed + 1;
+    }
+
+    # Metadata access levels from modify_metadata up include reading
+    msiSetACL("default", "admin:modify_metadata", *user, *archivePath);
+    *ec = errorcode(msiArchiveIndex(*archivePath, *index));
+    if (*ec < 0) {
+        writeLine("stdout", "msiArchiveIndex failed with modify_metadata access: *ec");
+        *failed = *failed + 1;
+    }
+    msiSetACL("default", "admin:own", *user, *archivePath);
+
+    # Access is restored
+    *ec = errorcode(msiArchiveIndex(*archivePath, *index));
+    if (*ec < 0) {
+        writeLine("stdout", "msiArchiveIndex failed with read access: *ec");
+        *failed = *failed + 1;
+    }
+
+    if (*failed == 0) {
+        writeLine("stdout", "Access to archive indexes is checked");
+    }
+}
+
+INPUT null
+OUTPUT ruleExecOut
@@ -0,0 +1,20 @@
+# Call with
+# irule -F msi_archive_index_query_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_index_query_test.r
+
+testArchiveIndexQuery {
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *offset = 0;
+    *limit = 10;
+    *filter = "data/*.txt"; # prefix or glob pattern, "" for all items
+    *fields = "name,size"; # comma-separated list of fields, "" for all fields
+    *index = "";
+
+    # Archive path, offset, limit, name filter, fields
+    msiArchiveIndexQuery(*archivePath, *offset, *limit, *filter, *fields, *index);
+    writeLine("stdout", *index);
+}
+
+INPUT null
+OUTPUT ruleExecOut
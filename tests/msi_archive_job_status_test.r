@@ -0,0 +1,52 @@
+# Call with
+# irule -F msi_archive_job_status_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_job_status_test.r
+#
+# Requires a running delay server: waits up to five minutes for the job to
+# be done.
+
+testArchiveJobStatus {
+    *sourceCollection = "/nlmumc/home/rods/test-data-collection";
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *jobStatus = "";
+    *status = 0;
+
+    # Only the delayed rule of a job may start its worker
+    msiString2KeyValPair("jobWorker=1", *options);
+    *ec = errorcode(msiArchiveCreate(*archivePath, *sourceCollection, *options, *status));
+    if (*ec >= 0) {
+        writeLine("stdout", "Archive job worker started without a job");
+    }
+
+    # Create the archive in the background
+    msiString2KeyValPair("job=1", *options);
+    msiArchiveCreate(*archivePath, *sourceCollection, *options, *status);
+    if (*status != 0) {
+        writeLine("stdout", "Archive job submission failed with status: *status");
+    } else {
+        # Archive path, action ("" or "cancel")
+        *state = "queued";
+        for (*i = 0; *i < 60 && (*state == "queued" || *state == "running"); *i = *i + 1) {
+            msiSleep("5", "0");
+            *ec = errorcode(msiArchiveJobStatus(*archivePath, "", *jobStatus));
+            if (*ec != 0) {
+                writeLine("stdout", "Archive job status query failed with status: *ec");
+                break;
+            }
+            msiString2KeyValPair("", *kvp);
+            msiAddKeyVal(*kvp, "state", "");
+            msi_json_objops(*jobStatus, *kvp, "get");
+            msiGetValByKey(*kvp, "state", *state);
+        }
+        writeLine("stdout", *jobStatus);
+        if (*state != "done") {
+            writeLine("stdout", "Archive job did not finish: *state");
+        } else {
+            writeLine("stdout", "Archive job done");
+        }
+    }
+}
+
+INPUT null
+OUTPUT ruleExecOut
@@ -0,0 +1,18 @@
+# Call with
+# irule -F msi_archive_read_member_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_read_member_test.r
+
+testArchiveReadMember {
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *member = "README.txt";
+    *offset = 0;
+    *length = 1024; # 0 for the whole member
+
+    # Archive path, member, offset, length
+    msiArchiveReadMember(*archivePath, *member, *offset, *length, *buf);
+    writeBytesBuf("stdout", *buf);
+}
+
+INPUT null
+OUTPUT ruleExecOut
@@ -0,0 +1,24 @@
+# Call with
+# irule -F msi_archive_verify_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_verify_test.r
+
+testArchiveVerify {
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.tar";
+    *report = "";
+    *status = 0;
+
+    # Archive path
+    *ec = errorcode(msiArchiveVerify(*archivePath, *report, *status));
+
+    # Error logging
+    if (*status != 0) {
+        writeLine("stdout", "Archive verification failed with status: *status");
+    } else {
+        writeLine("stdout", "Archive verified successfully");
+    }
+    writeLine("stdout", *report);
+}
+
+INPUT null
+OUTPUT ruleExecOut
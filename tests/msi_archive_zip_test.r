@@ -0,0 +1,43 @@
+# Call with
+# irule -F msi_archive_zip_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_archive_zip_test.r
+#
+# Creates a zip archive, compressed on several threads, and reads it back:
+# the archive must verify against its index, and extract completely.
+
+testArchiveZip {
+    *sourceCollection = "/nlmumc/home/rods/test-data-collection";
+    *archivePath = "/nlmumc/home/rods/msi_archive_backup/archive.zip";
+    *targetCollection = "/nlmumc/home/rods/test-data-extracted-zip";
+    *report = "";
+    *status = 0;
+    *failed = 0;
+
+    msiString2KeyValPair("zipThreads=4", *options);
+    msiArchiveCreate(*archivePath, *sourceCollection, *options, *status);
+    if (*status != 0) {
+        writeLine("stdout", "Zip archive creation failed with status: *status");
+        *failed = *failed + 1;
+    }
+
+    msiArchiveVerify(*archivePath, *report, *status);
+    if (*status != 0 || !(*report like "*\"ok\": true*")) {
+        writeLine("stdout", "Zip archive verification failed with status *status: *report");
+        *failed = *failed + 1;
+    }
+
+    *ec = errorcode(msiRmColl(*targetCollection, "forceFlag=", *status));
+    msiArchiveExtract(*archivePath, *targetCollection, "null", "null", *status);
+    if (*status != 0) {
+        writeLine("stdout", "Zip archive extraction failed with status: *status");
+        *failed = *failed + 1;
+    }
+
+    if (*failed == 0) {
+        writeLine("stdout", "Zip archive created, verified and extracted");
+    }
+}
+
+INPUT null
+OUTPUT ruleExecOut
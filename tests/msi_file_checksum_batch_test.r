@@ -0,0 +1,89 @@
+# Call with
+# irule -F msi_file_checksum_batch_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_file_checksum_batch_test.r
+#
+# Requires rodsadmin, and must run on the server that holds the resource.
+# Checksums a list of physical paths, once passed directly and once as a
+# manifest with the results written to a data object, and compares them
+# with the checksums iRODS computes itself. A path that does not exist
+# must give an error line.
+
+testFileChecksumBatch {
+    *coll = "/nlmumc/home/rods";
+    *resource = "demoResc";
+    *failed = 0;
+
+    foreach (*row in SELECT RESC_VAULT_PATH WHERE RESC_NAME = '*resource') {
+        *vault = *row.RESC_VAULT_PATH;
+    }
+    *missing = "*vault/msi_file_checksum_batch_test_missing";
+
+    # Two data objects and a path that does not exist
+    *paths = "";
+    *checksums = list();
+    for (*i = 0; *i < 2; *i = *i + 1) {
+        *path = "*coll/msi_file_checksum_batch_test_*i";
+        msiDataObjCreate(*path, "forceFlag=++++destRescName=*resource", *fd);
+        msiDataObjWrite(*fd, "contents of file *i", *len);
+        msiDataObjClose(*fd, *status);
+        msiDataObjChksum(*path, "forceChksum=", *checksum);
+        *checksums = cons(*checksum, *checksums);
+        msiSplitPath(*path, *collName, *dataName);
+        foreach (*row in SELECT DATA_PATH WHERE COLL_NAME = '*collName' AND DATA_NAME = '*dataName' AND DATA_RESC_NAME = '*resource') {
+            *paths = *paths ++ *row.DATA_PATH ++ "\n";
+        }
+    }
+    *paths = *paths ++ *missing ++ "\n";
+
+    # Paths passed directly, results returned
+    msiString2KeyValPair("resource=*resource++++threads=2", *options);
+    msiFileChecksumBatch(*paths, *options, *results);
+    writeLine("stdout", "Results: *results");
+    checkResults(*results, *checksums, *missing, *failed);
+
+    # Paths in a manifest, results written to a data object
+    *manifest = "*coll/msi_file_checksum_batch_test_manifest.txt";
+    *output = "*coll/msi_file_checksum_batch_test_results.jsonl";
+    msiDataObjCreate(*manifest, "forceFlag=++++destRescName=*resource", *fd);
+    msiDataObjWrite(*fd, *paths, *len);
+    msiDataObjClose(*fd, *status);
+    msiString2KeyValPair("resource=*resource++++manifest=*manifest++++output=*output", *options);
+    msiFileChecksumBatch("", *options, *results);
+    msiDataObjOpen("objPath=*output", *fd);
+    msiDataObjRead(*fd, 65536, *buf);
+    msiDataObjClose(*fd, *status);
+    msiBytesBufToStr(*buf, *results);
+    writeLine("stdout", "Results from manifest: *results");
+    checkResults(*results, *checksums, *missing, *failed);
+
+    msiDataObjUnlink("objPath=*manifest++++forceFlag=", *status);
+    msiDataObjUnlink("objPath=*output++++forceFlag=", *status);
+    for (*i = 0; *i < 2; *i = *i + 1) {
+        msiDataObjUnlink("objPath=*coll/msi_file_checksum_batch_test_*i++++forceFlag=", *status);
+    }
+
+    if (*failed == 0) {
+        writeLine("stdout", "All batch checksums match");
+    } else {
+        writeLine("stdout", "*failed batch checks failed");
+    }
+}
+
+# Every checksum computed by iRODS must be in the results, and the path that
+# does not exist must have an error line.
+checkResults(*results, *checksums, *missing, *failed) {
+    foreach (*checksum in *checksums) {
+        if (!(*results like "*\"checksum\":\"*checksum\"*")) {
+            writeLine("stdout", "Missing checksum *checksum");
+            *failed = *failed + 1;
+        }
+    }
+    if (!(*results like "*" ++ *missing ++ "*error*")) {
+        writeLine("stdout", "Missing error line for the path that does not exist");
+        *failed = *failed + 1;
+    }
+}
+
+INPUT null
+OUTPUT ruleExecOut
@@ -0,0 +1,143 @@
+# Call with
+# irule -F msi_file_checksum_test.r
+# Or call specifically with:
+# /bin/irule -r irods_rule_engine_plugin-irods_rule_language-instance -F msi_file_checksum_test.r
+#
+# Requires rodsadmin, and must run on the server that holds the resource.
+# Checks SHA-256 test vectors, and compares every checksum with the one
+# iRODS computes itself (chksumLocFile), through the page cache, with
+# direct I/O and from the checksum cache.
+
+testFileChecksum {
+    *coll = "/nlmumc/home/rods";
+    *resource = "demoResc";
+    *failed = 0;
+
+    # SHA-256 test vectors: padding boundaries at 55, 56 and 64 bytes, and
+    # messages of one and two blocks
+    *contents = list("",
+                     "abc",
+                     "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                     "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                     "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                     "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                     "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu");
+    *expected = list("sha2:47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=",
+                     "sha2:ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=",
+                     "sha2:JI1qYdIGOLjlwCaTDD5gOaM85Flk/yFn9uzt1BnbBsE=",
+                     "sha2:n0OQ+NMMLdkuyfCVtl4rmumwqSWlJY4kHJ8ekQ9zQxg=",
+                     "sha2:s1Q5pKxvCUi21vnjxq8PX1kM4g8b3nCQ73lwaG7Gc4o=",
+                     "sha2:/+BU/nrgy23GXDr5th1SCfQ5hR20PQulmXM33xVGaOs=",
+                     "sha2:z1sWp3ivg4ADbOWeewSSNwskmxHo8HpRr6xFA3r+6dE=");
+
+    for (*i = 0; *i < size(*contents); *i = *i + 1) {
+        *path = "*coll/msi_file_checksum_test_*i";
+        *content = elem(*contents, *i);
+        msiDataObjCreate(*path, "forceFlag=++++destRescName=*resource", *fd);
+        if (strlen(*content) > 0) {
+            msiDataObjWrite(*fd, *content, *len);
+        }
+        msiDataObjClose(*fd, *status);
+        checkFileChecksum(*path, *resource, elem(*expected, *i), *failed);
+    }
+
+    # About 10 MB, which spans several read blocks; every block starts with
+    # its number, so that no two chunks are the same
+    *block = "0123456789abcdef";
+    for (*i = 0; *i < 10; *i = *i + 1) {
+        *block = *block ++ *block;
+    }
+    *path = "*coll/msi_file_checksum_test_large";
+    msiDataObjCreate(*path, "forceFlag=++++destRescName=*resource", *fd);
+    for (*i = 0; *i < 600; *i = *i + 1) {
+        *data = "*i" ++ *block;
+        msiDataObjWrite(*fd, *data, *len);
+    }
+    msiDataObjClose(*fd, *status);
+
+    # Chunked checksums: all chunks with the root checksum, then only chunks
+    # 2 and 3, counting from 0, which must be the same as in the first run
+    msiSplitPath(*path, *collName, *dataName);
+    foreach (*row in SELECT DATA_PATH WHERE COLL_NAME = '*collName' AND DATA_NAME = '*dataName' AND DATA_RESC_NAME = '*resource') {
+        *physicalPath = *row.DATA_PATH;
+    }
+    msiString2KeyValPair("resource=*resource++++chunkSize=1048576++++threads=4", *options);
+    msiFileChecksum(*physicalPath, *options, *chunks);
+    msiString2KeyValPair("resource=*resource++++chunkSize=1048576++++firstChunk=2++++chunkCount=2", *options);
+    msiFileChecksum(*physicalPath, *options, *someChunks);
+    jsonGet(*chunks, "root", *root);
+    jsonGet(*chunks, "chunks", *all);
+    jsonGet(*someChunks, "chunks", *some);
+    msi_json_arrayops(*all, "", "size", *count);
+    msi_json_arrayops(*some, "", "size", *someCount);
+    if (*root != "sha2:YhsQOcOMtW7U9E9v/VN3qS3U3ZZ2/6czeQ5cWRXUDhY=" || *count != 10 || *someCount != 2) {
+        writeLine("stdout", "Mismatch for chunks: *chunks");
+        *failed = *failed + 1;
+    }
+    for (*i = 0; *i < 2; *i = *i + 1) {
+        *chunk = "";
+        *someChunk = "";
+        *n = *i + 2;
+        msi_json_arrayops(*all, *chunk, "get", *n);
+        *n = *i;
+        msi_json_arrayops(*some, *someChunk, "get", *n);
+        if (*chunk != *someChunk) {
+            writeLine("stdout", "Mismatch for chunk *i of *someChunks");
+            *failed = *failed + 1;
+        }
+    }
+
+    # Rate limited to 5 MiB/s, which should take about two seconds
+    msiString2KeyValPair("resource=*resource++++maxBandwidth=5++++maxIops=100", *options);
+    msiFileChecksum(*physicalPath, *options, *limitedChecksum);
+    msiFileChecksum(*physicalPath, *resource, *checksum);
+    if (*limitedChecksum != *checksum) {
+        writeLine("stdout", "Mismatch for rate limited *path: *limitedChecksum, unlimited *checksum");
+        *failed = *failed + 1;
+    }
+
+    checkFileChecksum(*path, *resource, "", *failed);
+
+    if (*failed == 0) {
+        writeLine("stdout", "All checksums match");
+    } else {
+        writeLine("stdout", "*failed checksums do not match");
+    }
+}
+
+# Get the value of a key in a JSON object, as a string.
+jsonGet(*json, *key, *value) {
+    msiString2KeyValPair("", *kvp);
+    msiAddKeyVal(*kvp, *key, "");
+    msi_json_objops(*json, *kvp, "get");
+    msiGetValByKey(*kvp, *key, *value);
+}
+
+# Compare the checksum of the replica of *path on *resource with *expected,
+# if not empty, and with the checksum computed by iRODS.
+checkFileChecksum(*path, *resource, *expected, *failed) {
+    msiSplitPath(*path, *collName, *dataName);
+    *physicalPath = "";
+    foreach (*row in SELECT DATA_PATH WHERE COLL_NAME = '*collName' AND DATA_NAME = '*dataName' AND DATA_RESC_NAME = '*resource') {
+        *physicalPath = *row.DATA_PATH;
+    }
+
+    msiFileChecksum(*physicalPath, *resource, *checksum);
+    msiString2KeyValPair("resource=*resource++++direct=1", *options);
+    msiFileChecksum(*physicalPath, *options, *directChecksum);
+    # The first call fills the checksum cache, the second one is answered from it
+    msiString2KeyValPair("resource=*resource++++cache=1", *options);
+    msiFileChecksum(*physicalPath, *options, *cachedChecksum);
+    msiFileChecksum(*physicalPath, *options, *cachedChecksum);
+    msiDataObjChksum(*path, "forceChksum=", *irodsChecksum);
+
+    if (*checksum != *irodsChecksum || *directChecksum != *irodsChecksum || *cachedChecksum != *irodsChecksum ||
+        (*expected != "" && *checksum != *expected)) {
+        writeLine("stdout", "Mismatch for *path: *checksum, direct *directChecksum, cached *cachedChecksum, iRODS *irodsChecksum, expected *expected");
+        *failed = *failed + 1;
+    }
+    msiDataObjUnlink("objPath=*path++++forceFlag=", *status);
+}
+
+INPUT null
+OUTPUT ruleExecOut